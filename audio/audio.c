@@ -3,6 +3,7 @@
 #include "audio/audio.h"
 #include "audio/input_pa.h"
 #include "audio/analyze.h"
+#include "util/profile.h"
 
 #include <SDL2/SDL_thread.h>
 #include <SDL2/SDL_timer.h>
@@ -16,7 +17,9 @@ static SDL_Thread* audio_thread;
 static double * double_chunk;
 
 static int audio_callback(chunk_pt chunk) {
+    uint64_t start = profile_now();
     analyze_chunk(chunk);
+    profile_cpu(start, "analyze");
 
     // Convert chunk (float[]) to an array of doubles
     for(int i = 0; i < config.audio.chunk_size; i++){
@@ -37,6 +40,7 @@ static int audio_callback(chunk_pt chunk) {
 }
 
 static int audio_run(void* args) {
+    profile_thread("Audio");
     audio_pa_run(&audio_callback, config.audio.sample_rate, config.audio.chunk_size);
 
     if(audio_running) return -1;
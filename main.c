@@ -2,12 +2,20 @@
 #include <SDL2/SDL_opengl.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include "ui/ui.h"
+#include "ui/control.h"
 #include "ui/render.h"
 #include "util/config.h"
 #include "util/err.h"
+#include "util/profile.h"
 #include "pattern/deck.h"
 #include "pattern/crossfader.h"
+#include "pattern/loader.h"
+#include "pattern/texpool.h"
+#include "pattern/index.h"
+#include "pattern/soft.h"
 #include "midi/midi.h"
 #include "audio/audio.h"
 #include "audio/analyze.h"
@@ -25,13 +33,52 @@ double audio_mid;
 double audio_low;
 double audio_level;
 
+// Play a recording made with the [record] output option, without audio, MIDI or OpenGL
+static int replay(const char * path, bool loop, uint64_t seek) {
+    if(SDL_Init(SDL_INIT_TIMER) < 0) FAIL("SDL could not initialize! SDL Error: %s\n", SDL_GetError());
+    int rc = output_replay(path, loop, seek);
+    SDL_Quit();
+    return rc < 0 ? EXIT_FAILURE : 0;
+}
+
 int main(int argc, char* args[]) {
     config_init(&config);
     config_load(&config, "resources/config.ini");
     params_init(&params);
     params_refresh();
 
-    ui_init();
+    const char * replay_path = NULL;
+    bool replay_loop = false;
+    uint64_t replay_seek = 0;
+    bool headless = false;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(args[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = args[++i];
+        } else if(strcmp(args[i], "--seek") == 0 && i + 1 < argc) {
+            replay_seek = strtoull(args[++i], NULL, 10);
+        } else if(strcmp(args[i], "--loop") == 0) {
+            replay_loop = true;
+        } else if(strcmp(args[i], "--headless") == 0) {
+            headless = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--headless] [--replay RECORDING [--seek FRAME] [--loop]]\n", args[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if(replay_path != NULL)
+        return replay(replay_path, replay_loop, replay_seek);
+
+    soft_init();
+    if(soft_enabled && !headless) {
+        INFO("The software renderer has no UI; running headless");
+        headless = true;
+    }
+    profile_init();
+
+    ui_init(headless);
+    pattern_globals_init();
+    pattern_index_init();
+    loader_start();
 
     for(int i=0; i < N_DECKS; i++) {
         deck_init(&deck[i]);
@@ -42,12 +89,15 @@ int main(int argc, char* args[]) {
     analyze_init();
     audio_start();
     midi_start();
+    control_start();
     output_init(&render);
 
     ui_run();
+    loader_stop();
     ui_term();
 
     output_term();
+    control_stop();
     midi_stop();
     audio_stop();
     analyze_term();
@@ -58,6 +108,12 @@ int main(int argc, char* args[]) {
 
     render_term(&render);
     crossfader_term(&crossfader);
+    texpool_term();
+    pattern_index_term();
+    pattern_globals_term();
+    ui_context_term();
+    soft_term();
+    profile_term();
 
     return 0;
 }
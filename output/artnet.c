@@ -0,0 +1,167 @@
+#include "output/artnet.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "output/backend.h"
+#include "output/config.h"
+#include "output/dmx.h"
+#include "output/udp.h"
+#include "util/err.h"
+#include "util/math.h"
+
+// This file implements an Art-Net output. Each strip is sent as ArtDmx packets
+// on consecutive universes (15-bit port addresses), either to a single node or
+// broadcast to the local network.
+
+#define ARTNET_PORT 6454
+#define ARTNET_HEADER_SIZE 18
+#define ARTNET_OP_DMX 0x5000
+#define ARTNET_PROTOCOL_VERSION 14
+#define ARTNET_MAX_UNIVERSE 0x7FFF
+
+static struct dmx_strip * strip_devices = NULL;
+static size_t n_strip_devices = 0;
+
+static int out_fd = -1;
+static struct udp_batch batch;
+
+static size_t artnet_finish(struct dmx_universe * universe) {
+    uint8_t * p = universe->packet;
+    // The data length must be even; the unused channels are always zero
+    size_t n_channels = MAX(2, universe->n_channels + (universe->n_channels & 1));
+
+    memcpy(&p[0], "Art-Net\0", 8);
+    p[8] = ARTNET_OP_DMX & 0xFF; // Little endian
+    p[9] = ARTNET_OP_DMX >> 8;
+    p[10] = 0; // Big endian from here on
+    p[11] = ARTNET_PROTOCOL_VERSION;
+    // Sequence numbers run 1-255; 0 disables reordering on the receiver
+    universe->sequence = universe->sequence % 255 + 1;
+    p[12] = universe->sequence;
+    p[13] = 0; // Physical port
+    p[14] = universe->number & 0xFF; // SubUni
+    p[15] = universe->number >> 8; // Net
+    p[16] = n_channels >> 8;
+    p[17] = n_channels & 0xFF;
+
+    return ARTNET_HEADER_SIZE + n_channels;
+}
+
+static int artnet_add_strips() {
+    n_strip_devices = output_config.n_artnet_strips;
+    strip_devices = calloc(n_strip_devices, sizeof *strip_devices);
+    if (strip_devices == NULL) MEMFAIL();
+
+    size_t n_universes = 0;
+    for (size_t i = 0; i < n_strip_devices; i++) {
+        struct dmx_strip * device = &strip_devices[i];
+        memset(device, 0, sizeof *device);
+        if (!output_config.artnet_strips[i].configured)
+            continue;
+
+        // Hook ourselves into the output_device_head list
+        if (output_device_head != NULL)
+            output_device_head->prev = &device->base;
+        device->base.next = output_device_head;
+        output_device_head = &device->base;
+        device->base.prev = NULL;
+
+        device->base.active = false;
+        device->base.vertex_head = output_config.artnet_strips[i].vertexlist;
+        device->base.ui_color = output_config.artnet_strips[i].ui_color;
+        device->base.ui_name = output_config.artnet_strips[i].ui_name;
+
+        int universe = output_config.artnet_strips[i].universe;
+        int length = output_config.artnet_strips[i].length;
+        int last_universe = universe + (length - 1) / DMX_PIXELS_PER_UNIVERSE;
+        if (universe < 0 || last_universe > ARTNET_MAX_UNIVERSE) {
+            ERROR("Art-Net strip '%s' uses universes %d-%d, outside of 0-%d",
+                  device->base.ui_name, universe, last_universe, ARTNET_MAX_UNIVERSE);
+            continue;
+        }
+        if (dmx_strip_init(device, length, universe, ARTNET_HEADER_SIZE) < 0)
+            continue;
+
+        // Without an address, broadcast to the whole network
+        const char * address = output_config.artnet_strips[i].address;
+        if (address == NULL || address[0] == '\0')
+            address = "255.255.255.255";
+        struct sockaddr_in addr;
+        if (dmx_parse_addr(address, ARTNET_PORT, &addr) < 0) {
+            ERROR("Invalid address '%s' for Art-Net strip '%s'", address, device->base.ui_name);
+            continue;
+        }
+        for (size_t j = 0; j < device->n_universes; j++)
+            device->universes[j].addr = addr;
+
+        device->base.active = true;
+        n_universes += device->n_universes;
+        INFO("Art-Net strip '%s' on universes %d-%d", device->base.ui_name, universe, last_universe);
+    }
+
+    udp_batch_init(&batch, MAX(n_universes, 1));
+    return 0;
+}
+
+static int artnet_init() {
+    out_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (out_fd < 0) {
+        PERROR("Error opening Art-Net socket");
+        return -1;
+    }
+
+    int broadcast = 1;
+    if (setsockopt(out_fd, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof broadcast) < 0)
+        PERROR("Unable to enable broadcast on Art-Net socket");
+
+    return artnet_add_strips();
+}
+
+static void artnet_term() {
+    INFO("Terminating Art-Net");
+
+    for (size_t i = 0; i < n_strip_devices; i++)
+        dmx_strip_term(&strip_devices[i]);
+    free(strip_devices);
+    strip_devices = NULL;
+    n_strip_devices = 0;
+
+    udp_batch_term(&batch);
+    if (out_fd >= 0) {
+        close(out_fd);
+        out_fd = -1;
+    }
+}
+
+static int artnet_prepare() {
+    for (size_t i = 0; i < n_strip_devices; i++) {
+        if (strip_devices[i].base.active)
+            dmx_strip_pack(&strip_devices[i]);
+    }
+    return 0;
+}
+
+static int artnet_transmit() {
+    for (size_t i = 0; i < n_strip_devices; i++) {
+        if (strip_devices[i].base.active)
+            dmx_strip_queue(&strip_devices[i], &batch, output_config.artnet.keepalive_ms, artnet_finish);
+    }
+
+    if (batch.length > 0 && udp_batch_send(out_fd, &batch) < 0) {
+        LOGLIMIT(PERROR, "Error sending Art-Net data");
+        return -1;
+    }
+    return 0;
+}
+
+const struct output_backend output_artnet_backend = {
+    .name = "Art-Net",
+    .enabled = &output_config.artnet.enabled,
+    .init = artnet_init,
+    .term = artnet_term,
+    .prepare = artnet_prepare,
+    .transmit = artnet_transmit,
+};
@@ -0,0 +1,26 @@
+#include "output/backend.h"
+
+#ifdef RADIANCE_LUX
+    #include "output/lux.h"
+#endif
+#ifdef RADIANCE_PP
+    #include "output/pixel_pusher.h"
+#endif
+#ifdef RADIANCE_DMX
+    #include "output/artnet.h"
+    #include "output/e131.h"
+#endif
+
+const struct output_backend * const output_backends[] = {
+#ifdef RADIANCE_LUX
+    &output_lux_backend,
+#endif
+#ifdef RADIANCE_PP
+    &output_pp_backend,
+#endif
+#ifdef RADIANCE_DMX
+    &output_e131_backend,
+    &output_artnet_backend,
+#endif
+    NULL,
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Interface implemented by each kind of output (lux, PixelPusher, ...).
+//
+// Each frame, the output thread samples every device and then calls `prepare`,
+// which should pack the sampled colors into the backend's own buffers.
+// `transmit` and `sync` are then called from the backend's own thread, so that
+// the output thread can sample the next frame while this one is being sent.
+// `prepare` is never called while `transmit` or `sync` is still running.
+//
+// Everything but `name`, `enabled`, `init` and `term` may be NULL.
+struct output_backend {
+    const char * name;
+
+    // Points at the backend's `enabled` configuration key
+    const int * enabled;
+
+    int (*init)();
+    void (*term)();
+
+    int (*prepare)();
+    int (*transmit)();
+    int (*sync)();
+
+    // Write a short human-readable status line into `buf`
+    void (*stats)(char * buf, size_t len);
+};
+
+// Every backend built into this binary, NULL-terminated
+extern const struct output_backend * const output_backends[];
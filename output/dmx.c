@@ -0,0 +1,100 @@
+#include "output/dmx.h"
+
+#include <arpa/inet.h>
+#include <SDL2/SDL_timer.h>
+#include <string.h>
+
+#include "util/err.h"
+#include "util/math.h"
+
+int dmx_strip_init(struct dmx_strip * strip, int length, int first_universe, size_t header_size) {
+    if (length <= 0) {
+        ERROR("DMX strip '%s' must have a positive length", strip->base.ui_name);
+        return -1;
+    }
+
+    strip->n_universes = (length + DMX_PIXELS_PER_UNIVERSE - 1) / DMX_PIXELS_PER_UNIVERSE;
+    strip->universes = calloc(strip->n_universes, sizeof *strip->universes);
+    if (strip->universes == NULL) MEMFAIL();
+
+    for (size_t i = 0; i < strip->n_universes; i++) {
+        struct dmx_universe * universe = &strip->universes[i];
+        universe->number = first_universe + i;
+        universe->n_channels = 3 * MIN(length - i * DMX_PIXELS_PER_UNIVERSE, DMX_PIXELS_PER_UNIVERSE);
+        universe->header_size = header_size;
+        universe->packet = calloc(1, header_size + DMX_UNIVERSE_SIZE);
+        if (universe->packet == NULL) MEMFAIL();
+    }
+
+    strip->base.pixels.length = length;
+    if (output_device_arrange(&strip->base) < 0) {
+        ERROR("Unable to arrange pixels for DMX strip '%s'", strip->base.ui_name);
+        // The strip stays linked, so it must not claim pixels it doesn't have
+        strip->base.pixels.length = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void dmx_strip_term(struct dmx_strip * strip) {
+    for (size_t i = 0; i < strip->n_universes; i++)
+        free(strip->universes[i].packet);
+    free(strip->universes);
+    free(strip->base.pixels.xs);
+    free(strip->base.pixels.ys);
+    free(strip->base.pixels.colors);
+
+    if (strip->base.prev != NULL)
+        strip->base.prev->next = strip->base.next;
+    else if (output_device_head == &strip->base)
+        output_device_head = strip->base.next;
+    if (strip->base.next != NULL)
+        strip->base.next->prev = strip->base.prev;
+    memset(strip, 0, sizeof *strip);
+}
+
+int dmx_parse_addr(const char * str, uint16_t port, struct sockaddr_in * addr) {
+    memset(addr, 0, sizeof *addr);
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    if (inet_pton(AF_INET, str, &addr->sin_addr) != 1)
+        return -1;
+    return 0;
+}
+
+void dmx_strip_pack(struct dmx_strip * strip) {
+    const SDL_Color * color = strip->base.pixels.colors;
+    for (size_t i = 0; i < strip->n_universes; i++) {
+        struct dmx_universe * universe = &strip->universes[i];
+        uint8_t * out_ptr = dmx_universe_data(universe);
+        for (size_t j = 0; j < universe->n_channels; j += 3) {
+            *out_ptr++ = output_premultiply(color->r, color->a);
+            *out_ptr++ = output_premultiply(color->g, color->a);
+            *out_ptr++ = output_premultiply(color->b, color->a);
+            color++;
+        }
+    }
+}
+
+void dmx_strip_queue(struct dmx_strip * strip, struct udp_batch * batch, uint32_t keepalive_ms, dmx_finish_fn finish) {
+    uint32_t now = SDL_GetTicks();
+    for (size_t i = 0; i < strip->n_universes; i++) {
+        struct dmx_universe * universe = &strip->universes[i];
+        const uint8_t * data = dmx_universe_data(universe);
+
+        // Receivers hold the last frame they got, so unchanged universes only
+        // need to be resent often enough that they don't time out
+        bool changed = !universe->sent || memcmp(universe->last, data, universe->n_channels) != 0;
+        if (!changed && now - universe->last_sent < keepalive_ms)
+            continue;
+
+        size_t length = finish(universe);
+        if (udp_batch_add(batch, &universe->addr, universe->packet, length) < 0) {
+            LOGLIMIT(WARN, "DMX output batch is full; dropping universe %d", universe->number);
+            continue;
+        }
+        memcpy(universe->last, data, universe->n_channels);
+        universe->last_sent = now;
+        universe->sent = true;
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "output/slice.h"
+#include "output/udp.h"
+
+// Shared pieces of the DMX-over-IP outputs (E1.31 and Art-Net).
+// A strip is packed as RGB pixels into consecutive universes, starting at
+// the first channel of its first universe. Pixels never straddle universes.
+
+#define DMX_UNIVERSE_SIZE 512
+#define DMX_PIXELS_PER_UNIVERSE (DMX_UNIVERSE_SIZE / 3)
+
+struct dmx_universe {
+    uint16_t number;
+    struct sockaddr_in addr;
+    size_t n_channels;
+    uint8_t sequence;
+
+    // Room for the protocol header, followed by the DMX data
+    size_t header_size;
+    uint8_t * packet;
+
+    // What was last sent, for delta suppression
+    uint8_t last[DMX_UNIVERSE_SIZE];
+    uint32_t last_sent;
+    bool sent;
+};
+
+struct dmx_strip {
+    struct output_device base;
+    size_t n_universes;
+    struct dmx_universe * universes;
+};
+
+// Fills in the protocol header of a universe's packet and returns the length of the packet
+typedef size_t (*dmx_finish_fn)(struct dmx_universe * universe);
+
+// Allocates the universes and arranges the pixels; the caller hooks the strip into the device list
+int dmx_strip_init(struct dmx_strip * strip, int length, int first_universe, size_t header_size);
+void dmx_strip_term(struct dmx_strip * strip);
+
+static inline uint8_t * dmx_universe_data(struct dmx_universe * universe) {
+    return universe->packet + universe->header_size;
+}
+
+// Parses a dotted IPv4 address; returns -1 if it is invalid
+int dmx_parse_addr(const char * str, uint16_t port, struct sockaddr_in * addr);
+
+// Copy the sampled colors into the DMX data of the strip's universes
+void dmx_strip_pack(struct dmx_strip * strip);
+
+// Queue every universe which changed since it was last sent, or which hasn't been
+// sent in `keepalive_ms`. The packets must not be touched until the batch is sent.
+void dmx_strip_queue(struct dmx_strip * strip, struct udp_batch * batch, uint32_t keepalive_ms, dmx_finish_fn finish);
@@ -0,0 +1,241 @@
+#include "output/e131.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "output/backend.h"
+#include "output/config.h"
+#include "output/dmx.h"
+#include "output/udp.h"
+#include "util/err.h"
+#include "util/math.h"
+
+// This file implements an E1.31 (streaming ACN) output. Each strip is sent as
+// consecutive universes, either multicast to the standard address for each
+// universe or unicast to a single controller.
+
+#define E131_PORT 5568
+#define E131_HEADER_SIZE 126 // Includes the DMX start code
+#define E131_SOURCE_NAME_SIZE 64
+#define E131_MIN_UNIVERSE 1
+#define E131_MAX_UNIVERSE 63999
+
+static struct dmx_strip * strip_devices = NULL;
+static size_t n_strip_devices = 0;
+
+static int out_fd = -1;
+static struct udp_batch batch;
+
+static uint8_t cid[16];
+static char source_name[E131_SOURCE_NAME_SIZE];
+static uint8_t priority;
+
+static inline void e131_put16(uint8_t * ptr, uint16_t x) {
+    ptr[0] = x >> 8;
+    ptr[1] = x & 0xFF;
+}
+
+static inline void e131_put32(uint8_t * ptr, uint32_t x) {
+    e131_put16(&ptr[0], x >> 16);
+    e131_put16(&ptr[2], x & 0xFFFF);
+}
+
+// Each layer starts with its length (from that point to the end of the packet) and 0x7 flags
+static inline void e131_put_flags_length(uint8_t * ptr, size_t length) {
+    e131_put16(ptr, 0x7000 | length);
+}
+
+static size_t e131_finish(struct dmx_universe * universe) {
+    uint8_t * p = universe->packet;
+    size_t length = E131_HEADER_SIZE + universe->n_channels;
+
+    // Root layer
+    e131_put16(&p[0], 0x0010);
+    e131_put16(&p[2], 0x0000);
+    memcpy(&p[4], "ASC-E1.17\0\0\0", 12);
+    e131_put_flags_length(&p[16], length - 16);
+    e131_put32(&p[18], 0x00000004); // VECTOR_ROOT_E131_DATA
+    memcpy(&p[22], cid, sizeof cid);
+
+    // Framing layer
+    e131_put_flags_length(&p[38], length - 38);
+    e131_put32(&p[40], 0x00000002); // VECTOR_E131_DATA_PACKET
+    memcpy(&p[44], source_name, E131_SOURCE_NAME_SIZE);
+    p[108] = priority;
+    e131_put16(&p[109], 0); // No synchronization universe
+    p[111] = universe->sequence++;
+    p[112] = 0; // Options
+    e131_put16(&p[113], universe->number);
+
+    // DMP layer
+    e131_put_flags_length(&p[115], length - 115);
+    p[117] = 0x02; // VECTOR_DMP_SET_PROPERTY
+    p[118] = 0xA1; // Address & data type
+    e131_put16(&p[119], 0); // First property address
+    e131_put16(&p[121], 1); // Address increment
+    e131_put16(&p[123], 1 + universe->n_channels);
+    p[125] = 0; // DMX start code
+
+    return length;
+}
+
+static int e131_add_strips() {
+    n_strip_devices = output_config.n_e131_strips;
+    strip_devices = calloc(n_strip_devices, sizeof *strip_devices);
+    if (strip_devices == NULL) MEMFAIL();
+
+    size_t n_universes = 0;
+    for (size_t i = 0; i < n_strip_devices; i++) {
+        struct dmx_strip * device = &strip_devices[i];
+        memset(device, 0, sizeof *device);
+        if (!output_config.e131_strips[i].configured)
+            continue;
+
+        // Hook ourselves into the output_device_head list
+        if (output_device_head != NULL)
+            output_device_head->prev = &device->base;
+        device->base.next = output_device_head;
+        output_device_head = &device->base;
+        device->base.prev = NULL;
+
+        device->base.active = false;
+        device->base.vertex_head = output_config.e131_strips[i].vertexlist;
+        device->base.ui_color = output_config.e131_strips[i].ui_color;
+        device->base.ui_name = output_config.e131_strips[i].ui_name;
+
+        int universe = output_config.e131_strips[i].universe;
+        int length = output_config.e131_strips[i].length;
+        int last_universe = universe + (length - 1) / DMX_PIXELS_PER_UNIVERSE;
+        if (universe < E131_MIN_UNIVERSE || last_universe > E131_MAX_UNIVERSE) {
+            ERROR("E1.31 strip '%s' uses universes %d-%d, outside of %d-%d",
+                  device->base.ui_name, universe, last_universe, E131_MIN_UNIVERSE, E131_MAX_UNIVERSE);
+            continue;
+        }
+        if (dmx_strip_init(device, length, universe, E131_HEADER_SIZE) < 0)
+            continue;
+
+        // Without an address, use the multicast group for each universe: 239.255.{hi}.{lo}
+        const char * address = output_config.e131_strips[i].address;
+        struct sockaddr_in unicast_addr;
+        bool multicast = address == NULL || address[0] == '\0';
+        if (!multicast && dmx_parse_addr(address, E131_PORT, &unicast_addr) < 0) {
+            ERROR("Invalid address '%s' for E1.31 strip '%s'", address, device->base.ui_name);
+            continue;
+        }
+        for (size_t j = 0; j < device->n_universes; j++) {
+            struct dmx_universe * u = &device->universes[j];
+            if (multicast) {
+                memset(&u->addr, 0, sizeof u->addr);
+                u->addr.sin_family = AF_INET;
+                u->addr.sin_port = htons(E131_PORT);
+                u->addr.sin_addr.s_addr = htonl(0xEFFF0000 | u->number);
+            } else {
+                u->addr = unicast_addr;
+            }
+        }
+
+        device->base.active = true;
+        n_universes += device->n_universes;
+        INFO("E1.31 strip '%s' on universes %d-%d", device->base.ui_name, universe, last_universe);
+    }
+
+    udp_batch_init(&batch, MAX(n_universes, 1));
+    return 0;
+}
+
+// Random (version 4) UUID, without touching the process-wide rand() state
+static void e131_make_cid() {
+    bool ok = false;
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        ok = read(fd, cid, sizeof cid) == (ssize_t) sizeof cid;
+        close(fd);
+    }
+    if (!ok) {
+        // xorshift64*, seeded from the clock and our PID
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t x = ((uint64_t) ts.tv_sec << 32) ^ (uint64_t) ts.tv_nsec ^ ((uint64_t) getpid() << 16);
+        x |= 1;
+        for (size_t i = 0; i < sizeof cid; i++) {
+            x ^= x >> 12;
+            x ^= x << 25;
+            x ^= x >> 27;
+            cid[i] = (x * 0x2545F4914F6CDD1Dull) >> 56;
+        }
+    }
+    cid[6] = (cid[6] & 0x0F) | 0x40; // UUID version 4
+    cid[8] = (cid[8] & 0x3F) | 0x80;
+}
+
+static int e131_init() {
+    out_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (out_fd < 0) {
+        PERROR("Error opening E1.31 socket");
+        return -1;
+    }
+
+    // Multicast should reach the local network, but not beyond it
+    unsigned char ttl = 1;
+    if (setsockopt(out_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof ttl) < 0)
+        PERROR("Unable to set E1.31 multicast TTL");
+
+    // Receivers tell sources apart by CID, so a fresh one each time we start up is fine
+    e131_make_cid();
+
+    memset(source_name, 0, sizeof source_name);
+    snprintf(source_name, sizeof source_name, "%s", output_config.e131.source_name);
+    priority = CLAMP(output_config.e131.priority, 0, 200);
+
+    return e131_add_strips();
+}
+
+static void e131_term() {
+    INFO("Terminating E1.31");
+
+    for (size_t i = 0; i < n_strip_devices; i++)
+        dmx_strip_term(&strip_devices[i]);
+    free(strip_devices);
+    strip_devices = NULL;
+    n_strip_devices = 0;
+
+    udp_batch_term(&batch);
+    if (out_fd >= 0) {
+        close(out_fd);
+        out_fd = -1;
+    }
+}
+
+static int e131_prepare() {
+    for (size_t i = 0; i < n_strip_devices; i++) {
+        if (strip_devices[i].base.active)
+            dmx_strip_pack(&strip_devices[i]);
+    }
+    return 0;
+}
+
+static int e131_transmit() {
+    for (size_t i = 0; i < n_strip_devices; i++) {
+        if (strip_devices[i].base.active)
+            dmx_strip_queue(&strip_devices[i], &batch, output_config.e131.keepalive_ms, e131_finish);
+    }
+
+    if (batch.length > 0 && udp_batch_send(out_fd, &batch) < 0) {
+        LOGLIMIT(PERROR, "Error sending E1.31 data");
+        return -1;
+    }
+    return 0;
+}
+
+const struct output_backend output_e131_backend = {
+    .name = "E1.31",
+    .enabled = &output_config.e131.enabled,
+    .init = e131_init,
+    .term = e131_term,
+    .prepare = e131_prepare,
+    .transmit = e131_transmit,
+};
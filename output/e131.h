@@ -0,0 +1,5 @@
+#pragma once
+
+#include "output/backend.h"
+
+extern const struct output_backend output_e131_backend;
@@ -5,6 +5,7 @@
 #include "output/lux.h"
 #include "output/slice.h"
 #include "output/config.h"
+#include "output/backend.h"
 
 #define LUX_DEBUG INFO
 #include "liblux/lux.h"
@@ -38,6 +39,7 @@ struct lux_device {
     int length;
     size_t frame_buffer_size;
     uint8_t * frame_buffer;
+    bool frame_ready;
 
     double max_energy;
     int oversample;
@@ -282,7 +284,7 @@ static void lux_device_term(struct lux_device * device) {
 
 // 
 
-void output_lux_term() {
+static void lux_term() {
     lux_channel_destroy_all();
     for (size_t i = 0; i < n_strip_devices; i++)
         lux_device_term(&strip_devices[i]);
@@ -293,7 +295,7 @@ void output_lux_term() {
     INFO("Lux terminated");
 }
 
-int output_lux_init() {
+static int lux_init() {
     // Set global configuration
     lux_timeout_ms = output_config.lux.timeout_ms;
 
@@ -500,13 +502,32 @@ int output_lux_init() {
     return 0;
 }
 
-int output_lux_prepare_frame() {
-    int rc = 0; (void) rc;
+static int lux_prepare() {
     for (size_t i = 0; i < n_strip_devices; i++) {
         struct lux_device * device = &strip_devices[i];
         if (device->channel == NULL) continue;
-        rc = lux_strip_prepare_frame(device);
-        if (rc < 0) continue;
+        device->frame_ready = lux_strip_prepare_frame(device) >= 0;
+    }
+    /*
+    for (size_t i = 0; i < n_spot_devices; i++) {
+        struct lux_device * device = &spot_devices[i];
+        if (device->channel == NULL) continue;
+        device->frame_ready = lux_spot_prepare_frame(device) >= 0;
+    }
+    */
+    for (size_t i = 0; i < n_grid_devices; i++) {
+        struct lux_device * device = &grid_devices[i];
+        if (device->channel == NULL) continue;
+        device->frame_ready = lux_grid_prepare_frame(device) >= 0;
+    }
+    return 0;
+}
+
+static int lux_transmit() {
+    int rc = 0; (void) rc;
+    for (size_t i = 0; i < n_strip_devices; i++) {
+        struct lux_device * device = &strip_devices[i];
+        if (device->channel == NULL || !device->frame_ready) continue;
         rc = lux_strip_frame(
                 device->channel->fd,
                 device->address,
@@ -517,9 +538,7 @@ int output_lux_prepare_frame() {
     /*
     for (size_t i = 0; i < n_spot_devices; i++) {
         struct lux_device * device = &spot_devices[i];
-        if (device->channel == NULL) continue;
-        rc = lux_spot_prepare_frame(device);
-        if (rc < 0) continue;
+        if (device->channel == NULL || !device->frame_ready) continue;
         rc = lux_spot_frame(
                 device->channel->fd,
                 device->address,
@@ -530,9 +549,7 @@ int output_lux_prepare_frame() {
     */
     for (size_t i = 0; i < n_grid_devices; i++) {
         struct lux_device * device = &grid_devices[i];
-        if (device->channel == NULL) continue;
-        rc = lux_grid_prepare_frame(device);
-        if (rc < 0) continue;
+        if (device->channel == NULL || !device->frame_ready) continue;
         rc = lux_grid_frame(
                 device->channel->fd,
                 device->address,
@@ -543,7 +560,7 @@ int output_lux_prepare_frame() {
     return 0;
 }
 
-int output_lux_sync_frame() {
+static int lux_sync_frame() {
     for (struct lux_channel * channel = channel_head; channel; channel = channel->next) {
         if (!channel->sync) continue;
         int rc = lux_frame_sync(channel->fd, LUX_BROADCAST_ADDRESS);
@@ -551,3 +568,13 @@ int output_lux_sync_frame() {
     }
     return 0;
 }
+
+const struct output_backend output_lux_backend = {
+    .name = "lux",
+    .enabled = &output_config.lux.enabled,
+    .init = lux_init,
+    .term = lux_term,
+    .prepare = lux_prepare,
+    .transmit = lux_transmit,
+    .sync = lux_sync_frame,
+};
@@ -1,7 +1,5 @@
 #pragma once
 
-int output_lux_init();
-void output_lux_term();
+#include "output/backend.h"
 
-int output_lux_prepare_frame();
-int output_lux_sync_frame();
+extern const struct output_backend output_lux_backend;
@@ -5,49 +5,381 @@
 #include "util/config.h"
 #include "util/err.h"
 #include "util/math.h"
+#include "util/profile.h"
+#include "util/ring.h"
 #include "output/output.h"
 #include "output/config.h"
 #include "output/slice.h"
-#ifdef RADIANCE_LUX
-    #include "output/lux.h"
-#endif
-#ifdef RADIANCE_PP
-    #include "output/pixel_pusher.h"
-#endif
+#include "output/backend.h"
+#include "output/record.h"
+#include "output/shm.h"
 
 static volatile int output_running;
 static volatile int output_refresh_request = false;
 static SDL_Thread * output_thread;
 static struct render * render = NULL;
 
-#ifdef RADIANCE_LUX
-    static bool output_on_lux = false;
-#endif
-#ifdef RADIANCE_PP
-    static bool output_on_pp = false;
-#endif
+// Frames flow through three stages for each enabled backend:
+//
+//  - The sampler (the output thread) samples the backend's devices into a free frame
+//    and pushes it onto the backend's `full_frames` ring. It never waits on a backend:
+//    if the backend has no free frames, that backend skips the frame.
+//  - The packer thread takes the newest full frame, copies it into the devices and
+//    calls `prepare`, then returns the frame on `free_frames`.
+//  - The transmitter thread calls `transmit` and `sync`, so that frame N is sent while
+//    frame N+1 is being packed.
+//
+// Frames are numbered by the sampler, so skipped frames show up in the stats.
+#define OUTPUT_N_FRAMES 4
 
-static int output_reload_devices() {
-    // Tear down
-    #ifdef RADIANCE_LUX
-        if (output_on_lux) {
-            output_lux_term();
+struct output_frame {
+    unsigned int seq;
+    SDL_Color * colors; // Every device of the backend, back to back
+};
+
+struct output_stage {
+    const struct output_backend * backend;
+    bool on;
+
+    // Devices which were added by this backend, which are `offset` pixels into `output_colors`
+    struct output_device ** devices;
+    size_t n_devices;
+    size_t n_pixels;
+    size_t offset;
+
+    struct output_frame frames[OUTPUT_N_FRAMES];
+    struct ring free_frames;   // Packer -> sampler
+    struct ring full_frames;   // Sampler -> packer
+    SDL_sem * frame_ready;
+    SDL_Thread * packer;
+    volatile int packing;
+    unsigned int last_seq;
+
+    SDL_Thread * transmitter;
+    SDL_mutex * lock;
+    SDL_cond * cond;
+    bool running;
+    bool busy;
+
+    // Sampler only
+    unsigned long n_dropped;
+
+    // Protected by `lock`
+    unsigned long n_frames;
+    unsigned long n_skipped;
+    unsigned long n_errors;
+    double transmit_ms;
+};
+
+static struct output_stage * stages = NULL;
+static size_t n_stages = 0;
+static unsigned int output_seq = 0;
+static bool output_on_shm = false;
+static bool output_on_record = false;
+
+// Every device's pixels, back to back, in the order of `output_device_head`
+static SDL_Color * output_colors = NULL;
+static size_t output_n_pixels = 0;
+
+// Replay a recording instead of sampling the render
+static const char * replay_path = NULL;
+static bool replay_loop = false;
+static uint64_t replay_seek = 0;
+static bool replay_failed = false;
+
+static int output_stage_transmit(const struct output_backend * backend) {
+    int rc = 0;
+    uint64_t start = profile_now();
+    if (backend->transmit != NULL)
+        rc = backend->transmit();
+    if (rc >= 0 && backend->sync != NULL)
+        rc = backend->sync();
+    profile_cpu(start, "%s transmit", backend->name);
+    if (rc < 0) LOGLIMIT(ERROR, "Unable to transmit %s frame", backend->name);
+    return rc;
+}
+
+static int output_transmitter_run(void * args) {
+    struct output_stage * stage = args;
+    double ticks_per_ms = SDL_GetPerformanceFrequency() / 1e3;
+    char name[64];
+    snprintf(name, sizeof name, "%s transmitter", stage->backend->name);
+    profile_thread(name);
+
+    SDL_LockMutex(stage->lock);
+    while (true) {
+        while (stage->running && !stage->busy)
+            SDL_CondWait(stage->cond, stage->lock);
+        if (!stage->running) break;
+        SDL_UnlockMutex(stage->lock);
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        int rc = output_stage_transmit(stage->backend);
+        double elapsed_ms = (SDL_GetPerformanceCounter() - start) / ticks_per_ms;
+
+        SDL_LockMutex(stage->lock);
+        stage->n_errors += rc < 0;
+        stage->transmit_ms = INTERP(0.99, stage->transmit_ms, elapsed_ms);
+        stage->busy = false;
+        SDL_CondSignal(stage->cond);
+    }
+    SDL_UnlockMutex(stage->lock);
+    profile_thread_exit();
+    return 0;
+}
+
+// Pack the frame, waiting for the transmitter first: it may still be sending
+// the previous frame out of the buffers `prepare` writes
+static void output_stage_pack(struct output_stage * stage, struct output_frame * frame) {
+    const struct output_backend * backend = stage->backend;
+
+    const SDL_Color * colors = frame->colors;
+    for (size_t i = 0; i < stage->n_devices; i++) {
+        struct output_device * dev = stage->devices[i];
+        // Devices that failed to arrange have no pixel arrays
+        if (dev->pixels.colors != NULL)
+            memcpy(dev->pixels.colors, colors, dev->pixels.length * sizeof *colors);
+        colors += dev->pixels.length;
+    }
+
+    SDL_LockMutex(stage->lock);
+    while (stage->busy)
+        SDL_CondWait(stage->cond, stage->lock);
+    stage->n_frames++;
+    stage->n_skipped += frame->seq - stage->last_seq - 1;
+    SDL_UnlockMutex(stage->lock);
+    stage->last_seq = frame->seq;
+
+    if (backend->prepare != NULL) {
+        uint64_t start = profile_now();
+        int rc = backend->prepare();
+        profile_cpu(start, "%s prepare", backend->name);
+        if (rc < 0) {
+            LOGLIMIT(ERROR, "Unable to prepare %s frame", backend->name);
+            return;
+        }
+    }
+
+    if (stage->transmitter != NULL) {
+        SDL_LockMutex(stage->lock);
+        stage->busy = true;
+        SDL_CondSignal(stage->cond);
+        SDL_UnlockMutex(stage->lock);
+    } else if (backend->transmit != NULL || backend->sync != NULL) {
+        if (output_stage_transmit(backend) < 0) {
+            SDL_LockMutex(stage->lock);
+            stage->n_errors++;
+            SDL_UnlockMutex(stage->lock);
         }
-    #endif
+    }
+}
+
+static int output_packer_run(void * args) {
+    struct output_stage * stage = args;
+    char name[64];
+    snprintf(name, sizeof name, "%s packer", stage->backend->name);
+    profile_thread(name);
 
-    #ifdef RADIANCE_PP
-        if (output_on_pp) {
-            output_pp_term();
+    while (stage->packing) {
+        if (SDL_SemWaitTimeout(stage->frame_ready, 100) != 0) continue;
+
+        // Only the newest frame matters; hand any older ones straight back
+        struct output_frame * frame = NULL;
+        struct output_frame * next;
+        while ((next = ring_pop(&stage->full_frames)) != NULL) {
+            if (frame != NULL) ring_push(&stage->free_frames, frame);
+            frame = next;
         }
-    #endif
+        if (frame == NULL) continue;
+
+        output_stage_pack(stage, frame);
+        ring_push(&stage->free_frames, frame);
+    }
+    profile_thread_exit();
+    return 0;
+}
+
+// Remember which devices this backend added to the front of the device list
+static void output_stage_collect(struct output_stage * stage, struct output_device * old_head) {
+    stage->n_devices = 0;
+    stage->n_pixels = 0;
+    for (struct output_device * dev = output_device_head; dev != old_head; dev = dev->next) {
+        stage->n_devices++;
+        stage->n_pixels += dev->pixels.length;
+    }
+
+    stage->devices = calloc(stage->n_devices, sizeof *stage->devices);
+    if (stage->devices == NULL && stage->n_devices > 0) MEMFAIL();
+    size_t i = 0;
+    for (struct output_device * dev = output_device_head; dev != old_head; dev = dev->next)
+        stage->devices[i++] = dev;
+}
+
+static int output_stage_start(struct output_stage * stage) {
+    const struct output_backend * backend = stage->backend;
+
+    ring_init(&stage->free_frames, OUTPUT_N_FRAMES);
+    ring_init(&stage->full_frames, OUTPUT_N_FRAMES);
+    for (size_t i = 0; i < OUTPUT_N_FRAMES; i++) {
+        stage->frames[i].colors = calloc(MAX(stage->n_pixels, 1), sizeof *stage->frames[i].colors);
+        if (stage->frames[i].colors == NULL) MEMFAIL();
+        ring_push(&stage->free_frames, &stage->frames[i]);
+    }
+    stage->last_seq = output_seq;
+    stage->n_frames = 0;
+    stage->n_skipped = 0;
+    stage->n_dropped = 0;
+    stage->n_errors = 0;
+    stage->transmit_ms = 0;
+
+    if (backend->transmit != NULL || backend->sync != NULL) {
+        stage->running = true;
+        stage->busy = false;
+        stage->transmitter = SDL_CreateThread(&output_transmitter_run, backend->name, stage);
+        if (stage->transmitter == NULL) {
+            // Fall back to transmitting from the packer thread
+            ERROR("Could not create %s transmit thread: %s", backend->name, SDL_GetError());
+            stage->running = false;
+        }
+    }
+
+    stage->packing = true;
+    stage->packer = SDL_CreateThread(&output_packer_run, backend->name, stage);
+    if (stage->packer == NULL) {
+        ERROR("Could not create %s packer thread: %s", backend->name, SDL_GetError());
+        stage->packing = false;
+        return -1;
+    }
+    return 0;
+}
+
+static void output_stage_stop(struct output_stage * stage) {
+    if (stage->packer != NULL) {
+        stage->packing = false;
+        SDL_SemPost(stage->frame_ready);
+        SDL_WaitThread(stage->packer, NULL);
+        stage->packer = NULL;
+    }
+
+    if (stage->transmitter != NULL) {
+        SDL_LockMutex(stage->lock);
+        stage->running = false;
+        SDL_CondSignal(stage->cond);
+        SDL_UnlockMutex(stage->lock);
+
+        SDL_WaitThread(stage->transmitter, NULL);
+        stage->transmitter = NULL;
+    }
+
+    while (SDL_SemTryWait(stage->frame_ready) == 0);
+    ring_term(&stage->free_frames);
+    ring_term(&stage->full_frames);
+    for (size_t i = 0; i < OUTPUT_N_FRAMES; i++) {
+        free(stage->frames[i].colors);
+        stage->frames[i].colors = NULL;
+    }
+    free(stage->devices);
+    stage->devices = NULL;
+    stage->n_devices = 0;
+}
+
+// Sample every device (or read them from a recording), and give each backend a fresh frame
+static void output_sample() {
+    output_seq++;
+    if (replay_path != NULL) {
+        if (output_replay_frame(output_colors) < 0) {
+            INFO("Finished replaying '%s'", replay_path);
+            output_running = false;
+            return;
+        }
+        if (output_on_shm)
+            output_shm_export(NULL, output_colors);
+    } else {
+        render_freeze(render);
+        bool canvas = render_has_canvas(render);
+        bool stale = false;
+        SDL_Color * colors = output_colors;
+        size_t point = 0; // Only arranged devices have points to sample
+        for (struct output_device * dev = output_device_head; dev; dev = dev->next) {
+            if (dev->pixels.xs != NULL) {
+                if (dev->active && !render_sample_points(render, point, dev->pixels.length, colors)) {
+                    if (canvas) output_device_sample(dev, render, colors);
+                    else stale = true;
+                }
+                point += dev->pixels.length;
+            }
+            colors += dev->pixels.length;
+        }
+        // Without a canvas, wait for the points to be sampled, and let the devices keep showing
+        // the previous frame until then
+        if (stale) {
+            render_thaw(render);
+            return;
+        }
+        if (output_on_shm)
+            output_shm_export(canvas ? render : NULL, output_colors);
+        render_thaw(render);
+    }
+    output_render_count++;
+
+    if (output_on_record)
+        output_record_frame(output_colors);
+
+    for (size_t i = 0; i < n_stages; i++) {
+        struct output_stage * stage = &stages[i];
+        if (!stage->on || stage->packer == NULL) continue;
+
+        struct output_frame * frame = ring_pop(&stage->free_frames);
+        if (frame == NULL) {
+            // The backend is still busy with every frame we've given it
+            stage->n_dropped++;
+            continue;
+        }
+
+        frame->seq = output_seq;
+        memcpy(frame->colors, output_colors + stage->offset, stage->n_pixels * sizeof *frame->colors);
+        ring_push(&stage->full_frames, frame);
+        SDL_SemPost(stage->frame_ready);
+    }
+}
+
+static void output_stage_stats(struct output_stage * stage) {
+    char buf[256] = "";
+    if (stage->backend->stats != NULL)
+        stage->backend->stats(buf, sizeof buf);
+
+    SDL_LockMutex(stage->lock);
+    DEBUG("%s: %lu frames, %lu skipped, %lu dropped, %lu errors, %0.2fms/transmit; %s", stage->backend->name,
+          stage->n_frames, stage->n_skipped, stage->n_dropped, stage->n_errors, stage->transmit_ms, buf);
+    SDL_UnlockMutex(stage->lock);
+}
+
+static void output_term_devices() {
+    if (output_on_shm) {
+        output_shm_term();
+        output_on_shm = false;
+    }
+    if (output_on_record) {
+        output_record_close();
+        output_on_record = false;
+    }
+    output_replay_close();
+
+    for (size_t i = 0; i < n_stages; i++) {
+        if (!stages[i].on) continue;
+        output_stage_stop(&stages[i]);
+        stages[i].backend->term();
+        stages[i].on = false;
+    }
+    // Every backend has unhooked (or freed) its devices
+    output_device_head = NULL;
+}
+
+static int output_reload_devices() {
+    // Tear down
+    output_term_devices();
 
     // Reload configuration
-    #ifdef RADIANCE_LUX
-        output_on_lux = false;
-    #endif
-    #ifdef RADIANCE_PP
-        output_on_pp = false;
-    #endif
     int rc = output_config_load(&output_config, params.paths.output_config);
     if (rc < 0) {
         ERROR("Unable to load output configuration");
@@ -55,26 +387,69 @@ static int output_reload_devices() {
     }
 
     // Initialize
-    #ifdef RADIANCE_LUX
-        if (output_config.lux.enabled) {
-            int rc = output_lux_init();
-            if (rc < 0) PERROR("Unable to initialize lux");
-            else output_on_lux = true;
+    for (size_t i = 0; i < n_stages; i++) {
+        struct output_stage * stage = &stages[i];
+        if (!*stage->backend->enabled) continue;
+
+        struct output_device * old_head = output_device_head;
+        int rc = stage->backend->init();
+        if (rc < 0) {
+            PERROR("Unable to initialize %s", stage->backend->name);
+            continue;
         }
-    #endif
+        stage->on = true;
+        output_stage_collect(stage, old_head);
+        output_stage_start(stage);
+    }
 
-    #ifdef RADIANCE_PP
-        if (output_config.pixel_pusher.enabled) {
-            int rc = output_pp_init();
-            if (rc < 0) PERROR("Unable to initialize pixel pusher");
-            else output_on_pp = true;
+    // Each backend's devices are a contiguous run of the device list
+    output_n_pixels = 0;
+    for (struct output_device * dev = output_device_head; dev; dev = dev->next) {
+        for (size_t i = 0; i < n_stages; i++) {
+            if (stages[i].on && stages[i].n_devices > 0 && stages[i].devices[0] == dev)
+                stages[i].offset = output_n_pixels;
         }
-    #endif
+        output_n_pixels += dev->pixels.length;
+    }
+    free(output_colors);
+    output_colors = calloc(MAX(output_n_pixels, 1), sizeof *output_colors);
+    if (output_colors == NULL) MEMFAIL();
+
+    // Tell the renderer which parts of the canvas are actually sampled
+    if (render != NULL && replay_path == NULL) {
+        render_coverage_begin(render);
+        for (struct output_device * dev = output_device_head; dev; dev = dev->next) {
+            if (dev->pixels.xs == NULL) continue;
+            for (size_t i = 0; i < dev->pixels.length; i++)
+                render_coverage_add(render, dev->pixels.xs[i], dev->pixels.ys[i]);
+        }
+        render_coverage_end(render);
+    }
+
+    if (replay_path != NULL) {
+        if (output_replay_open(replay_path, replay_loop, replay_seek) < 0) {
+            ERROR("Unable to replay '%s'", replay_path);
+            replay_failed = true;
+            output_running = false;
+        }
+    } else if (output_config.record.enabled) {
+        int rc = output_record_open(output_config.record.path, output_config.record.keyframe_interval);
+        if (rc < 0) ERROR("Unable to start recording");
+        else output_on_record = true;
+    }
+
+    if (output_config.shm.enabled) {
+        int rc = output_shm_init();
+        if (rc < 0) ERROR("Unable to initialize shared memory export");
+        else output_on_shm = true;
+    }
 
     return 0;
 }
 
 int output_run(void * args) {
+    profile_thread("Output");
+    output_running = true;
     output_reload_devices();
 
     /*
@@ -85,7 +460,6 @@ int output_run(void * args) {
     double stat_ops = 100;
     int render_count = 0;
 
-    output_running = true;
     int last_tick = SDL_GetTicks();
     unsigned int last_output_render_count = output_render_count;
     (void) last_output_render_count; //TODO
@@ -98,23 +472,9 @@ int output_run(void * args) {
 
         //if (last_output_render_count == output_render_count)
         last_output_render_count = output_render_count;
-        int rc = output_render(render);
-        if (rc < 0) PERROR("Unable to render");
-
-        #ifdef RADIANCE_LUX
-            if (output_on_lux) {
-                int rc = output_lux_prepare_frame();
-                if (rc < 0) PERROR("Unable to prepare lux frame");
-                rc = output_lux_sync_frame();
-                if (rc < 0) PERROR("Unable to sync lux frame");
-            }
-        #endif
-
-        #ifdef RADIANCE_PP
-            if (output_on_pp) {
-                if (output_pp_do_frame() < 0) PERROR("Unable to do PixelPusher frame");
-            }
-        #endif
+        uint64_t start = profile_now();
+        output_sample();
+        profile_cpu(start, "output");
 
         //SDL_framerateDelay(&fps_manager);
         SDL_Delay(1);
@@ -129,18 +489,20 @@ int output_run(void * args) {
         last_tick = tick;
 
         render_count++;
-        if (render_count % 101 == 0)
+        if (render_count % 101 == 0) {
             DEBUG("Output FPS: %0.2f; delta=%d", stat_ops, delta);
+            for (size_t i = 0; i < n_stages; i++) {
+                if (stages[i].on)
+                    output_stage_stats(&stages[i]);
+            }
+        }
     }
 
     // Destroy output
-    #ifdef RADIANCE_LUX
-        if(output_on_lux) output_lux_term();
-    #endif
-    #ifdef RADIANCE_PP
-        if (output_on_pp) output_pp_term();
-    #endif
+    output_term_devices();
     output_config_del(&output_config);
+    free(output_colors);
+    output_colors = NULL;
 
     INFO("Output stopped");
     return 0;
@@ -150,12 +512,41 @@ void output_init(struct render * _render) {
     output_config_init(&output_config);
     render = _render;
 
+    while (output_backends[n_stages] != NULL)
+        n_stages++;
+    stages = calloc(n_stages, sizeof *stages);
+    if (stages == NULL) MEMFAIL();
+    for (size_t i = 0; i < n_stages; i++) {
+        stages[i].backend = output_backends[i];
+        stages[i].lock = SDL_CreateMutex();
+        if (stages[i].lock == NULL) FAIL("Could not create mutex: %s", SDL_GetError());
+        stages[i].cond = SDL_CreateCond();
+        if (stages[i].cond == NULL) FAIL("Could not create condition variable: %s", SDL_GetError());
+        stages[i].frame_ready = SDL_CreateSemaphore(0);
+        if (stages[i].frame_ready == NULL) FAIL("Could not create semaphore: %s", SDL_GetError());
+    }
+
     output_thread = SDL_CreateThread(&output_run, "Output", 0);
     if(!output_thread) FAIL("Could not create output thread: %s\n", SDL_GetError());
 }
 
 void output_term() {
     output_running = false;
+    // Wait for the output thread so that recordings are closed properly
+    SDL_WaitThread(output_thread, NULL);
+    output_thread = NULL;
+}
+
+int output_replay(const char * path, bool loop, uint64_t seek) {
+    replay_path = path;
+    replay_loop = loop;
+    replay_seek = seek;
+    replay_failed = false;
+
+    output_init(NULL);
+    SDL_WaitThread(output_thread, NULL);
+    output_thread = NULL;
+    return replay_failed ? -1 : 0;
 }
 
 void output_refresh() {
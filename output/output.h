@@ -1,6 +1,12 @@
 #pragma once
+#include <stdbool.h>
+#include <stdint.h>
 #include "ui/render.h"
 
 void output_init(struct render * render);
 void output_term();
 void output_refresh();
+
+// Play back a recording through the output backends, without sampling a render.
+// Returns once the recording ends.
+int output_replay(const char * path, bool loop, uint64_t seek);
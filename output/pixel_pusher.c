@@ -3,96 +3,293 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <SDL2/SDL.h>
+#include <SDL2/SDL_thread.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "output/config.h"
+#include "output/udp.h"
 #include "util/err.h"
+#include "util/math.h"
 
-// This file implements a PixelPusher output.  It is designed to discover only 1 PixelPusher,
-// but to use multiple grids attached to that PixelPusher
+// This file implements a PixelPusher output.  A discovery thread keeps listening for the
+// broadcasts that every PixelPusher sends out, and tracks each controller by its MAC address.
+// Grids are attached to controllers by the `controller` key in their configuration, and
+// each controller gets its own queue of packets to send every frame.
+//
+// The output thread only packs frames; a separate transmit thread paces the packets out
+// to each controller with a token bucket.
 
-static struct pp_discovery_packet pp_info;
+#define PP_DEVICE_TYPE_PIXELPUSHER 2
+
+// Update periods longer than this are bogus (the PixelPusher reports huge values while
+// it is still booting), so don't let them stall the transmit thread
+#define PP_MAX_PACKET_INTERVAL_US 100000
+
+static struct pp_controller controllers[PP_MAX_CONTROLLERS];
+static volatile size_t n_controllers = 0;
+static SDL_mutex * controller_lock = NULL;
+static SDL_cond * controller_found = NULL;
+
+static volatile int discovery_running = false;
+static SDL_Thread * discovery_thread = NULL;
+static int discovery_fd = -1;
 
 static struct pp_device * grid_devices = NULL;
 static size_t n_grid_devices = 0;
 
 // Reusable state for sending data packets
 static int out_fd = -1;
-static uint32_t seq_num = 0;
-static struct sockaddr_in out_addr;
 
-// This is dynamic because we need to allocate memory based on
-// the number of pixels per strip.
-static uint8_t * out_packet;
+static volatile int transmit_running = false;
+static SDL_Thread * transmit_thread = NULL;
+static SDL_mutex * transmit_lock = NULL;
+static SDL_cond * transmit_wake = NULL;
+
+static const char * pp_format_mac(const uint8_t * mac) {
+    static char buf[18]; // not re-entrant!!!
+    snprintf(buf, sizeof buf, "%02hhx:%02hhx:%02hhx:%02hhx:%02hhx:%02hhx",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    return buf;
+}
+
+static int pp_parse_mac(const char * str, uint8_t * mac) {
+    if (sscanf(str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+               &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) != 6)
+        return -1;
+    return 0;
+}
+
+// Must be called with controller_lock held
+static void pp_handle_discovery(const struct pp_discovery_packet * packet) {
+    struct pp_controller * controller = NULL;
+    for (size_t i = 0; i < n_controllers; i++) {
+        if (memcmp(controllers[i].mac_addr, packet->header.mac_addr, sizeof controllers[i].mac_addr) == 0) {
+            controller = &controllers[i];
+            break;
+        }
+    }
+
+    struct in_addr ip_addr;
+    ip_addr.s_addr = packet->header.ip_addr;
+
+    if (controller == NULL) {
+        if (n_controllers >= PP_MAX_CONTROLLERS) {
+            LOGLIMIT(WARN, "Ignoring PixelPusher %s; already tracking %d controllers",
+                     pp_format_mac(packet->header.mac_addr), PP_MAX_CONTROLLERS);
+            return;
+        }
+        controller = &controllers[n_controllers];
+        memset(controller, 0, sizeof *controller);
+        memcpy(controller->mac_addr, packet->header.mac_addr, sizeof controller->mac_addr);
+        n_controllers++;
+        INFO("Found PixelPusher %s at IP address %s with %d strips",
+             pp_format_mac(controller->mac_addr), inet_ntoa(ip_addr), packet->info.strips_attached);
+    } else if (controller->addr.sin_addr.s_addr != packet->header.ip_addr) {
+        INFO("PixelPusher %s moved to IP address %s",
+             pp_format_mac(controller->mac_addr), inet_ntoa(ip_addr));
+    }
+
+    controller->info = packet->info;
+    controller->addr.sin_family = AF_INET;
+    controller->addr.sin_addr.s_addr = packet->header.ip_addr;
+    controller->addr.sin_port = htons(packet->info.my_port);
+    controller->last_seen = SDL_GetTicks();
+}
+
+static int pp_discovery_run(void * args) {
+    struct pp_discovery_packet packet;
+
+    while (discovery_running) {
+        size_t expected_bytes = sizeof packet;
+        ssize_t bytes_read = read(discovery_fd, &packet, expected_bytes);
+        if (bytes_read < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                LOGLIMIT(PERROR, "Unable to read from PixelPusher discovery socket");
+            continue;
+        }
+        if (bytes_read < (ssize_t) expected_bytes) {
+            LOGLIMIT(WARN, "Expected to read %zu bytes from PixelPusher but read %zd bytes",
+                     expected_bytes, bytes_read);
+            continue;
+        }
+        if (packet.header.device_type != PP_DEVICE_TYPE_PIXELPUSHER)
+            continue;
 
-// See output_pp_do_frame for why we need this
-static struct timespec packet_interval = { .tv_sec = 0, .tv_nsec = 500*1000};
+        SDL_LockMutex(controller_lock);
+        pp_handle_discovery(&packet);
+        SDL_CondBroadcast(controller_found);
+        SDL_UnlockMutex(controller_lock);
+    }
 
-static void numToHex(uint8_t* outstr, int val){
-    const char str[] = "0123456789ABCDEF";
-    outstr[0] = str[val / 16];
-    outstr[1] = str[val % 16];
-    outstr[2] = '\0';
+    return 0;
 }
 
-static int pp_find_pusher() {
-    INFO("Initializing PixelPusher");
+static int pp_start_discovery() {
+    INFO("Initializing PixelPusher discovery");
 
     // Try to open a socket
-    int server_fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (server_fd < 0) {
+    discovery_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (discovery_fd < 0) {
         PERROR("Error opening PixelPusher discovery socket");
         return -1;
     }
 
-    // Set its timeout
-    struct timeval tv;
-    tv.tv_sec = output_config.pixel_pusher.discovery_seconds;
-    if (!tv.tv_sec) {
-        ERROR("PixelPusher discovery seconds must be non-zero");
-        close(server_fd);
-        return -1;
+    int reuse = 1;
+    if (setsockopt(discovery_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse) < 0) {
+        PERROR("Error setting PixelPusher discovery socket to reuse its address");
+        goto fail;
     }
 
-    tv.tv_usec = 0;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_RCVTIMEO, (char *) &tv, sizeof(struct timeval)) < 0) {
+    // Wake up periodically so that the discovery thread can be stopped
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 100 * 1000 };
+    if (setsockopt(discovery_fd, SOL_SOCKET, SO_RCVTIMEO, (char *) &tv, sizeof(struct timeval)) < 0) {
         PERROR("Error setting PixelPusher discovery socket timeout");
-        close(server_fd);
-        return -1;
+        goto fail;
     }
 
     // Socket address
     struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof server_addr);
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
     server_addr.sin_port = htons(output_config.pixel_pusher.port);
 
     // Bind the socket
-    if (bind(server_fd, (struct sockaddr *) &server_addr, sizeof server_addr) < 0) {
+    if (bind(discovery_fd, (struct sockaddr *) &server_addr, sizeof server_addr) < 0) {
         PERROR("Error binding PixelPusher discovery socket");
-        close(server_fd);
-        return -1;
+        goto fail;
     }
 
-    // Read
-    size_t expected_bytes = sizeof pp_info;
-    int bytes_read = read(server_fd, &pp_info, expected_bytes);
-    if (bytes_read < (int) expected_bytes) {
-        PERROR("Expected to read %zu bytes from PixelPusher but read %d bytes", expected_bytes, bytes_read);
-        close(server_fd);
-        return -1;
+    discovery_running = true;
+    discovery_thread = SDL_CreateThread(&pp_discovery_run, "PixelPusher Discovery", 0);
+    if (discovery_thread == NULL) {
+        ERROR("Could not create PixelPusher discovery thread: %s", SDL_GetError());
+        discovery_running = false;
+        goto fail;
     }
 
-    close(server_fd);
+    return 0;
 
-    struct in_addr ip_addr;
-    ip_addr.s_addr = pp_info.header.ip_addr;
-    INFO("Found PixelPusher at IP address %s", inet_ntoa(ip_addr));
+fail:
+    close(discovery_fd);
+    discovery_fd = -1;
+    return -1;
+}
 
-    return 0;
+static void pp_stop_discovery() {
+    if (discovery_thread != NULL) {
+        discovery_running = false;
+        SDL_WaitThread(discovery_thread, NULL);
+        discovery_thread = NULL;
+    }
+    if (discovery_fd >= 0) {
+        close(discovery_fd);
+        discovery_fd = -1;
+    }
+}
+
+// Lay out every grid attached to this controller into as few packets as the controller
+// allows, and preallocate a buffer for each packet. Must be called with controller_lock held.
+// This only happens once per controller, because all of the grids for a controller are
+// attached as soon as it is discovered.
+static void pp_plan_packets(struct pp_controller * controller) {
+    size_t n_grids = 0;
+    size_t max_length = 0;
+    for (size_t i = 0; i < n_grid_devices; i++) {
+        if (grid_devices[i].controller != controller) continue;
+        n_grids++;
+        max_length = MAX(max_length, grid_devices[i].base.pixels.length);
+    }
+    if (n_grids == 0) return;
+
+    controller->strips_per_packet = MAX(1, controller->info.max_strips_per_packet);
+    controller->strip_length = controller->info.pixels_per_strip;
+    if (controller->strip_length == 0) {
+        WARN("PixelPusher %s did not report its strip length; using %zu",
+             pp_format_mac(controller->mac_addr), max_length);
+        controller->strip_length = max_length;
+    }
+
+    controller->n_slots = (n_grids + controller->strips_per_packet - 1) / controller->strips_per_packet;
+    controller->slot_grids = calloc(controller->n_slots * controller->strips_per_packet, sizeof *controller->slot_grids);
+    if (controller->slot_grids == NULL) MEMFAIL();
+
+    size_t slot = 0;
+    for (size_t i = 0; i < n_grid_devices; i++) {
+        struct pp_device * device = &grid_devices[i];
+        if (device->controller != controller) continue;
+
+        if (device->base.pixels.length > controller->strip_length)
+            WARN("PixelPusher grid '%s' has %zu pixels, but strips on %s only have %zu; truncating",
+                 device->base.ui_name, device->base.pixels.length,
+                 pp_format_mac(controller->mac_addr), controller->strip_length);
+        if (device->strip_num < 0 || device->strip_num >= controller->info.strips_attached)
+            WARN("PixelPusher grid '%s' uses strip %d, but %s only has %d strips",
+                 device->base.ui_name, device->strip_num,
+                 pp_format_mac(controller->mac_addr), controller->info.strips_attached);
+
+        controller->slot_grids[slot++] = device;
+    }
+
+    // 4 bytes for the sequence number; each strip has a 1 byte strip
+    // number and 3 bytes (RGB) for each pixel on the strip
+    size_t packet_size = 4 + controller->strips_per_packet * (1 + 3 * controller->strip_length);
+    for (size_t f = 0; f < 3; f++) {
+        struct pp_frame * frame = &controller->frames[f];
+        frame->packets = calloc(controller->n_slots, sizeof *frame->packets);
+        if (frame->packets == NULL) MEMFAIL();
+        for (size_t k = 0; k < controller->n_slots; k++) {
+            frame->packets[k].data = calloc(1, packet_size);
+            if (frame->packets[k].data == NULL) MEMFAIL();
+        }
+    }
+
+    INFO("Sending %zu grid(s) to PixelPusher %s in %zu packet(s) of up to %d strips",
+         n_grids, pp_format_mac(controller->mac_addr), controller->n_slots, controller->strips_per_packet);
+
+    // The transmit thread ignores controllers until `front` is set
+    SDL_LockMutex(transmit_lock);
+    controller->back = &controller->frames[0];
+    controller->pending = &controller->frames[1];
+    controller->front = &controller->frames[2];
+    controller->last_refill = SDL_GetPerformanceCounter();
+    SDL_UnlockMutex(transmit_lock);
+}
+
+// Attach any unattached grids to the controllers discovered so far.
+// Must be called with controller_lock held. Returns the number of unattached grids.
+static size_t pp_attach_grids() {
+    size_t n_unattached = 0;
+    for (size_t i = 0; i < n_grid_devices; i++) {
+        struct pp_device * device = &grid_devices[i];
+        if (!device->base.active || device->controller != NULL) continue;
+
+        for (size_t j = 0; j < n_controllers; j++) {
+            if (device->any_controller ||
+                memcmp(device->mac_addr, controllers[j].mac_addr, sizeof device->mac_addr) == 0) {
+                device->controller = &controllers[j];
+                break;
+            }
+        }
+
+        if (device->controller == NULL) {
+            n_unattached++;
+            continue;
+        }
+
+        struct pp_controller * controller = device->controller;
+        INFO("Attached PixelPusher grid '%s' to controller %s",
+             device->base.ui_name, pp_format_mac(controller->mac_addr));
+    }
+
+    for (size_t j = 0; j < n_controllers; j++) {
+        if (controllers[j].front == NULL)
+            pp_plan_packets(&controllers[j]);
+    }
+    return n_unattached;
 }
 
 static int pp_add_grids() {
@@ -118,6 +315,16 @@ static int pp_add_grids() {
         device->base.ui_name = output_config.pixel_pusher_grids[i].ui_name;
         device->strip_num = output_config.pixel_pusher_grids[i].strip_num;
 
+        // Controller this grid is attached to
+        const char * controller = output_config.pixel_pusher_grids[i].controller;
+        if (controller == NULL || controller[0] == '\0') {
+            device->any_controller = true;
+        } else if (pp_parse_mac(controller, device->mac_addr) < 0) {
+            ERROR("Invalid PixelPusher controller MAC address '%s' for grid %zu", controller, i);
+            device->base.active = false;
+            return -1;
+        }
+
         // Geometry and pixel arrangement
         // TODO: Maybe do some sanity checking on configuration
         // TODO: Maybe read this from the device itself (via the PixelPusher struct in packet.py),
@@ -134,16 +341,25 @@ static int pp_add_grids() {
             device->base.active = false;
             return -1;
         }
+
+        // Snake: The PixelPusher has linear strips arranged into a grid
+        // by going "back and forth". Precompute which sampled pixel goes where on the strip.
+        device->snake_map = calloc(device->base.pixels.length, sizeof *device->snake_map);
+        if (device->snake_map == NULL) MEMFAIL();
+        size_t strip_idx = 0;
+        for (int j = 0; j < device->height; j++) {
+            for (int k = 0; k < device->width; k++) {
+                device->snake_map[strip_idx++] = (j % 2 ? device->width - 1 - k: k)*(device->height) + j;
+            }
+        }
     }
 
     return 0;
 }
 
 static int pp_init_out() {
-    seq_num = 0;
-
     // Try to open a socket
-    if (out_fd > 0) {
+    if (out_fd >= 0) {
         close(out_fd);
     }
     out_fd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -152,43 +368,147 @@ static int pp_init_out() {
         return -1;
     }
 
-    // Target address
-    // This is only called if pp_find_pusher finishes successfully, so
-    // pp_info is set
-    out_addr.sin_family = AF_INET;
-    out_addr.sin_addr.s_addr = pp_info.header.ip_addr;
-    out_addr.sin_port = htons(pp_info.info.my_port);
+    return 0;
+}
+
+// Paces packets out to every controller: each controller's token bucket refills at one
+// packet per update period, and everything that is ready goes out in a single batch
+static int pp_transmit_run(void * args) {
+    double ticks_per_us = SDL_GetPerformanceFrequency() / 1e6;
+    double max_burst = MAX(1, output_config.pixel_pusher.max_burst);
+
+    // Each controller can contribute at most max_burst packets per batch
+    struct udp_batch batch;
+    udp_batch_init(&batch, PP_MAX_CONTROLLERS * (size_t) max_burst);
+
+    SDL_LockMutex(transmit_lock);
+    while (transmit_running) {
+        uint64_t now = SDL_GetPerformanceCounter();
+        double wait_us = -1;
+        bool idle = true;
+
+        size_t n = n_controllers;
+        for (size_t i = 0; i < n; i++) {
+            struct pp_controller * controller = &controllers[i];
+            if (controller->front == NULL) continue;
+
+            // Move on to the newest frame once the current one is out
+            if (controller->front_idx >= controller->front->n_packets && controller->has_pending) {
+                struct pp_frame * tmp = controller->front;
+                controller->front = controller->pending;
+                controller->pending = tmp;
+                controller->has_pending = false;
+                controller->front_idx = 0;
+            }
+
+            struct pp_frame * frame = controller->front;
+            double interval = frame->packet_interval_us;
+            double elapsed = (now - controller->last_refill) / ticks_per_us;
+            controller->tokens = MIN(controller->tokens + elapsed / interval, max_burst);
+            controller->last_refill = now;
+
+            if (controller->front_idx >= frame->n_packets) continue;
+            idle = false;
+
+            while (controller->tokens >= 1. && controller->front_idx < frame->n_packets) {
+                struct pp_packet * packet = &frame->packets[controller->front_idx++];
+                controller->seq_num++;
+                memcpy(packet->data, &controller->seq_num, sizeof controller->seq_num);
+                udp_batch_add(&batch, &frame->addr, packet->data, packet->length);
+                controller->tokens -= 1.;
+            }
+
+            if (controller->front_idx < frame->n_packets) {
+                double until_token = (1. - controller->tokens) * interval;
+                if (wait_us < 0 || until_token < wait_us) wait_us = until_token;
+            }
+        }
+
+        if (idle) {
+            SDL_CondWait(transmit_wake, transmit_lock);
+            continue;
+        }
+        SDL_UnlockMutex(transmit_lock);
+
+        // The front frames are only swapped by this thread, so they are safe to read unlocked
+        if (batch.length > 0) {
+            if (udp_batch_send(out_fd, &batch) < 0)
+                LOGLIMIT(PERROR, "Error sending PixelPusher data");
+        } else if (wait_us > 0) {
+            // The PixelPusher doesn't have a very large Ethernet buffer, and UDP doesn't resend
+            // things, so if we don't give it some time to process it'll just drop any more
+            // incoming packets. The symptom of this is only some of the grids will respond and
+            // the others will stay dark or flicker; if this happens increase min_packet_interval_us.
+            struct timespec ts = { .tv_sec = 0, .tv_nsec = MIN(wait_us, 1e6) * 1000 };
+            nanosleep(&ts, NULL);
+        }
 
-    // 4 bytes for the sequence number; 2 strips each with a 1 byte strip
-    // number and 3 bytes (RGB) for each pixel
-    out_packet = calloc(1, 4 + 2*(1+3*grid_devices[0].base.pixels.length));
-    if (out_packet == NULL) MEMFAIL();
+        SDL_LockMutex(transmit_lock);
+    }
+    SDL_UnlockMutex(transmit_lock);
 
+    udp_batch_term(&batch);
     return 0;
 }
 
-int output_pp_init() {
-    if (pp_find_pusher() < 0) {
+static int pp_start_transmit() {
+    transmit_running = true;
+    transmit_thread = SDL_CreateThread(&pp_transmit_run, "PixelPusher Transmit", 0);
+    if (transmit_thread == NULL) {
+        ERROR("Could not create PixelPusher transmit thread: %s", SDL_GetError());
+        transmit_running = false;
         return -1;
     }
+    return 0;
+}
 
-    if (pp_add_grids() < 0) {
-        return -1;
+static void pp_stop_transmit() {
+    if (transmit_thread == NULL) return;
+
+    SDL_LockMutex(transmit_lock);
+    transmit_running = false;
+    SDL_CondSignal(transmit_wake);
+    SDL_UnlockMutex(transmit_lock);
+
+    SDL_WaitThread(transmit_thread, NULL);
+    transmit_thread = NULL;
+}
+
+static int pp_wait_for_controllers() {
+    // Wait until every grid has found its controller, or we run out of time
+    uint32_t deadline = SDL_GetTicks() + output_config.pixel_pusher.discovery_seconds * 1000;
+    SDL_LockMutex(controller_lock);
+    size_t n_unattached;
+    while ((n_unattached = pp_attach_grids()) > 0) {
+        int32_t remaining = deadline - SDL_GetTicks();
+        if (remaining <= 0) break;
+        SDL_CondWaitTimeout(controller_found, controller_lock, remaining);
     }
+    size_t n_found = n_controllers;
+    SDL_UnlockMutex(controller_lock);
 
-    return pp_init_out();
+    INFO("Found %zu PixelPusher(s)", n_found);
+    if (n_unattached > 0)
+        WARN("%zu PixelPusher grid(s) will be attached when their controller is discovered", n_unattached);
+    return 0;
 }
 
-void output_pp_term() {
+static void pp_term() {
     INFO("Terminating PixelPusher");
 
+    pp_stop_discovery();
+    pp_stop_transmit();
+
     for (size_t i = 0; i < n_grid_devices; i++) {
         struct output_device base = grid_devices[i].base;
 
+        free(grid_devices[i].snake_map);
         free(base.pixels.xs);
         free(base.pixels.ys);
         free(base.pixels.colors);
 
+        if (output_device_head == &grid_devices[i].base)
+            output_device_head = base.next;
         if (base.prev != NULL)
             base.prev->next = base.next;
         if (base.next != NULL)
@@ -198,75 +518,154 @@ void output_pp_term() {
     grid_devices = NULL;
     n_grid_devices = 0;
 
+    for (size_t i = 0; i < n_controllers; i++) {
+        struct pp_controller * controller = &controllers[i];
+        for (size_t f = 0; f < 3; f++) {
+            if (controller->frames[f].packets == NULL) continue;
+            for (size_t k = 0; k < controller->n_slots; k++)
+                free(controller->frames[f].packets[k].data);
+            free(controller->frames[f].packets);
+        }
+        free(controller->slot_grids);
+        memset(controller, 0, sizeof *controller);
+    }
+    n_controllers = 0;
 
-    if (out_fd) {
+    if (out_fd >= 0) {
         close(out_fd);
         out_fd = -1;
     }
+}
 
-    if (out_packet) {
-        free(out_packet);
-        out_packet = NULL;
+static int pp_init() {
+    if (output_config.pixel_pusher.discovery_seconds <= 0) {
+        ERROR("PixelPusher discovery seconds must be positive");
+        return -1;
     }
-}
 
-int output_pp_do_frame() {
-    seq_num++;
+    if (controller_lock == NULL) {
+        controller_lock = SDL_CreateMutex();
+        if (controller_lock == NULL) FAIL("Could not create mutex: %s", SDL_GetError());
+        controller_found = SDL_CreateCond();
+        if (controller_found == NULL) FAIL("Could not create condition variable: %s", SDL_GetError());
+        transmit_lock = SDL_CreateMutex();
+        if (transmit_lock == NULL) FAIL("Could not create mutex: %s", SDL_GetError());
+        transmit_wake = SDL_CreateCond();
+        if (transmit_wake == NULL) FAIL("Could not create condition variable: %s", SDL_GetError());
+    }
+    n_controllers = 0;
 
-    ((char *) out_packet)[0] = seq_num;
-    // We'll use this to keep track of our location in the packet buffer
-    // as we fill it.  The sequence number is 4 bytes so we start after that.
-    size_t out_packet_idx = 4;
+    if (pp_add_grids() < 0)
+        goto fail;
 
-    for (size_t i = 0; i < n_grid_devices; i++) {
-        struct pp_device * device = &grid_devices[i];
+    if (pp_init_out() < 0)
+        goto fail;
 
-        // Make sure it was successfully initialized
-        if (!device->base.active) continue;
+    if (pp_start_transmit() < 0)
+        goto fail;
 
-        // Copy the data to send into a buffer - sadly SDL_Color is rgba
-        // so we can't just send a header and it using sendmsg
-        out_packet[out_packet_idx++] = device->strip_num;
+    if (pp_start_discovery() < 0)
+        goto fail;
 
-        // Snake: The PixelPusher has linear strips arranged into a grid
-        // by going "back and forth".
-        for (int j = 0; j < device->height; j++) {
-            for (int k = 0; k < device->width; k++) {
-                int idx = (j % 2 ? device->width - 1 - k: k)*(device->height) + j;
-
-                SDL_Color color = device->base.pixels.colors[idx];
-                double alpha = color.a / 255.0;
-                numToHex(&out_packet[out_packet_idx++],color.r * alpha);
-                numToHex(&out_packet[out_packet_idx++],color.g * alpha);
-                numToHex(&out_packet[out_packet_idx++],color.b * alpha);
-                //out_packet[out_packet_idx++] = numToHex(color.g * alpha);
-                //out_packet[out_packet_idx++] = numToHex(color.b * alpha);
-            }
-        }
+    if (pp_wait_for_controllers() < 0)
+        goto fail;
 
-        // Send it: the PixelPusher can take 2 grids per packet
-        if ((i % 2) || (i == n_grid_devices - 1)) {
-            size_t sent_bytes = sendto(out_fd, out_packet, out_packet_idx, 0, (struct sockaddr *) &out_addr, sizeof out_addr);
-            if (sent_bytes < out_packet_idx) {
-                PERROR("Error sending PixelPusher data");
-                return -1;
-            }
+    return 0;
 
-            // The PixelPusher doesn't have a very large Ethernet buffer, and UDP doesn't resend things,
-            // so if we don't give it some time to process it'll just drop any more incoming packets. The
-            // symptom of this is only some of the grids will respond and the others will stay dark or
-            // flicker; if this happens increase packet_interval.  Don't bother doing this on the last
-            // packet, because any reasonable framerate will have delays much longer than this (even, say
-            // 1000 FPS = 1 millisecond > 500 microseconds.
-            if (i != n_grid_devices - 1) {
-                nanosleep(&packet_interval, NULL);
+fail:
+    // Stop the threads and unhook the grids, so that the next reload starts from scratch
+    pp_term();
+    return -1;
+}
+
+// Pack one frame for this controller according to its packet plan
+static void pp_pack_frame(struct pp_controller * controller) {
+    struct pp_frame * frame = controller->back;
+    size_t strip_bytes = 3 * controller->strip_length;
+
+    for (size_t p = 0; p < controller->n_slots; p++) {
+        struct pp_packet * packet = &frame->packets[p];
+        // The sequence number is 4 bytes; it is filled in when the packet is sent
+        uint8_t * out_ptr = packet->data + 4;
+
+        for (int i = 0; i < controller->strips_per_packet; i++) {
+            const struct pp_device * device = controller->slot_grids[p * controller->strips_per_packet + i];
+            if (device == NULL) break;
+
+            // Copy the data to send into a buffer - sadly SDL_Color is rgba
+            // so we can't just send a header and it using sendmsg
+            *out_ptr++ = device->strip_num;
+
+            const SDL_Color * colors = device->base.pixels.colors;
+            const uint32_t * snake_map = device->snake_map;
+            size_t length = MIN(device->base.pixels.length, controller->strip_length);
+            for (size_t j = 0; j < length; j++) {
+                SDL_Color color = colors[snake_map[j]];
+                *out_ptr++ = output_premultiply(color.r, color.a);
+                *out_ptr++ = output_premultiply(color.g, color.a);
+                *out_ptr++ = output_premultiply(color.b, color.a);
             }
 
-            // Reset the packet buffer index to after the sequence number - it will
-            // stay the same for all of the packets in this frame.
-            out_packet_idx = 4;
+            // The PixelPusher expects every strip to be full length
+            memset(out_ptr, 0, strip_bytes - 3 * length);
+            out_ptr += strip_bytes - 3 * length;
         }
+
+        packet->length = out_ptr - packet->data;
+    }
+    frame->n_packets = controller->n_slots;
+}
+
+// Give the packed frame to the transmit thread, replacing any frame it hasn't started on yet
+static void pp_hand_off(struct pp_controller * controller) {
+    struct pp_frame * frame = controller->back;
+
+    SDL_LockMutex(controller_lock);
+    frame->addr = controller->addr;
+    uint32_t interval = MAX(controller->info.update_period, (uint32_t) output_config.pixel_pusher.min_packet_interval_us);
+    frame->packet_interval_us = CLAMP(interval, 1, PP_MAX_PACKET_INTERVAL_US);
+    SDL_UnlockMutex(controller_lock);
+
+    SDL_LockMutex(transmit_lock);
+    controller->back = controller->pending;
+    controller->pending = frame;
+    controller->has_pending = true;
+    SDL_CondSignal(transmit_wake);
+    SDL_UnlockMutex(transmit_lock);
+}
+
+static int pp_prepare() {
+    // Pick up any PixelPushers which were discovered since the last frame
+    SDL_LockMutex(controller_lock);
+    pp_attach_grids();
+    size_t n = n_controllers;
+    SDL_UnlockMutex(controller_lock);
+
+    // The transmit thread takes it from here
+    for (size_t i = 0; i < n; i++) {
+        if (controllers[i].back == NULL) continue;
+        pp_pack_frame(&controllers[i]);
+        pp_hand_off(&controllers[i]);
     }
 
     return 0;
 }
+
+static void pp_stats(char * buf, size_t len) {
+    SDL_LockMutex(controller_lock);
+    size_t n_attached = 0;
+    for (size_t i = 0; i < n_grid_devices; i++)
+        n_attached += grid_devices[i].controller != NULL;
+    snprintf(buf, len, "%zu controller(s), %zu/%zu grid(s) attached", n_controllers, n_attached, n_grid_devices);
+    SDL_UnlockMutex(controller_lock);
+}
+
+// Packets are paced out by our own transmit thread, so there is no `transmit` stage
+const struct output_backend output_pp_backend = {
+    .name = "PixelPusher",
+    .enabled = &output_config.pixel_pusher.enabled,
+    .init = pp_init,
+    .term = pp_term,
+    .prepare = pp_prepare,
+    .stats = pp_stats,
+};
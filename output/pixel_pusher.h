@@ -1,7 +1,10 @@
 #pragma once
 
+#include <netinet/in.h>
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "output/backend.h"
 #include "output/slice.h"
 
 // https://github.com/robot-head/PixelPusher-python/blob/master/heroicrobot/pixelpusher/discovery.py
@@ -50,6 +53,56 @@ struct __attribute__((__packed__)) pp_discovery_packet {
     struct pixel_pusher_info info;
 };
 
+// Maximum number of PixelPushers tracked by the discovery service
+#define PP_MAX_CONTROLLERS 64
+
+struct pp_device;
+
+struct pp_packet {
+    size_t length;
+    uint8_t * data;
+};
+
+struct pp_frame {
+    size_t n_packets;
+    struct pp_packet * packets;
+
+    // Snapshot of where and how fast to send, taken when the frame is handed off
+    struct sockaddr_in addr;
+    uint32_t packet_interval_us;
+};
+
+struct pp_controller {
+    // Everything in this block is written by the discovery thread,
+    // so it must be read with the controller lock held
+    uint8_t mac_addr[6];
+    struct sockaddr_in addr;
+    struct pixel_pusher_info info;
+    uint32_t last_seen;
+
+    // Packet plan, built by the output thread when grids are first attached.
+    // Slot i of packet p carries grid `slot_grids[p * strips_per_packet + i]` (or nothing).
+    size_t n_slots;
+    int strips_per_packet;
+    size_t strip_length;
+    struct pp_device ** slot_grids;
+
+    // Triple-buffered send queue: the output thread packs into `back` and swaps it
+    // with `pending`; the transmit thread swaps `pending` into `front` and sends it.
+    // Swaps happen with the transmit lock held.
+    struct pp_frame frames[3];
+    struct pp_frame * back;
+    struct pp_frame * pending;
+    struct pp_frame * front;
+    bool has_pending;
+
+    // Only touched by the transmit thread
+    size_t front_idx;
+    uint32_t seq_num;
+    double tokens;
+    uint64_t last_refill;
+};
+
 struct pp_device {
     struct output_device base;
 
@@ -57,9 +110,15 @@ struct pp_device {
     int height;
 
     int strip_num;
-};
 
-int output_pp_init();
-void output_pp_term();
+    // Index into `base.pixels` for each pixel along the strip
+    uint32_t * snake_map;
+
+    // MAC address of the controller this grid is attached to;
+    // if `any_controller` is set, the first PixelPusher discovered is used
+    bool any_controller;
+    uint8_t mac_addr[6];
+    struct pp_controller * controller;
+};
 
-int output_pp_do_frame();
+extern const struct output_backend output_pp_backend;
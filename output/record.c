@@ -0,0 +1,395 @@
+#include "output/record.h"
+
+#include <fcntl.h>
+#include <SDL2/SDL_timer.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "output/slice.h"
+#include "util/err.h"
+#include "util/lz4.h"
+#include "util/math.h"
+
+// Recording state
+static FILE * record_file = NULL;
+static size_t record_size = 0;
+static uint8_t * record_prev = NULL;
+static uint8_t * record_delta = NULL;
+static uint8_t * record_out = NULL;
+static uint64_t record_frame = 0;
+static uint64_t record_offset = 0;
+static Uint64 record_start = 0;
+static int record_keyframe_interval = 1;
+static struct output_record_index * record_index = NULL;
+static size_t record_n_index = 0;
+static size_t record_index_capacity = 0;
+
+// Replay state
+static uint8_t * replay_map = NULL;
+static size_t replay_map_size = 0;
+static size_t replay_size = 0;
+static size_t replay_start = 0;
+static size_t replay_end = 0;
+static size_t replay_offset = 0;
+static uint8_t * replay_pixels = NULL;
+static uint8_t * replay_delta = NULL;
+static struct output_record_index * replay_index = NULL;
+static size_t replay_n_index = 0;
+static bool replay_loop = false;
+static bool replay_restart = true;
+static Uint64 replay_t0 = 0;
+static uint64_t replay_ts0 = 0;
+
+static size_t record_count_pixels(size_t * n_devices) {
+    size_t n_pixels = 0;
+    *n_devices = 0;
+    for (struct output_device * dev = output_device_head; dev; dev = dev->next) {
+        (*n_devices)++;
+        n_pixels += dev->pixels.length;
+    }
+    return n_pixels;
+}
+
+static int record_write(const void * data, size_t size) {
+    if (fwrite(data, 1, size, record_file) != size) {
+        LOGLIMIT(PERROR, "Unable to write recording");
+        return -1;
+    }
+    record_offset += size;
+    return 0;
+}
+
+int output_record_open(const char * path, int keyframe_interval) {
+    char filename[1024];
+    time_t now = time(NULL);
+    if (strftime(filename, sizeof filename, path, localtime(&now)) == 0) {
+        ERROR("Invalid recording path '%s'", path);
+        return -1;
+    }
+
+    record_file = fopen(filename, "wb");
+    if (record_file == NULL) {
+        PERROR("Unable to open recording '%s'", filename);
+        return -1;
+    }
+
+    size_t n_devices;
+    size_t n_pixels = record_count_pixels(&n_devices);
+    record_size = n_pixels * sizeof(SDL_Color);
+    record_prev = calloc(1, MAX(record_size, 1));
+    record_delta = calloc(1, MAX(record_size, 1));
+    record_out = calloc(1, LZ4_BOUND(record_size));
+    if (record_prev == NULL || record_delta == NULL || record_out == NULL) MEMFAIL();
+    record_frame = 0;
+    record_offset = 0;
+    record_start = SDL_GetPerformanceCounter();
+    record_keyframe_interval = MAX(keyframe_interval, 1);
+    record_n_index = 0;
+
+    struct output_record_header header = {
+        .magic = OUTPUT_RECORD_MAGIC,
+        .n_devices = n_devices,
+        .n_pixels = n_pixels,
+    };
+    record_write(&header, sizeof header);
+    for (struct output_device * dev = output_device_head; dev; dev = dev->next) {
+        struct output_record_device entry = { .length = dev->pixels.length };
+        snprintf(entry.name, sizeof entry.name, "%s", dev->ui_name != NULL ? dev->ui_name : "");
+        record_write(&entry, sizeof entry);
+    }
+
+    INFO("Recording %zu devices to '%s'", n_devices, filename);
+    return 0;
+}
+
+void output_record_frame(const SDL_Color * colors) {
+    if (record_file == NULL) return;
+
+    // Most pixels don't change from one frame to the next, so their XOR compresses very well
+    bool keyframe = record_frame % record_keyframe_interval == 0;
+    const uint8_t * pixels = (const uint8_t *) colors;
+    const uint8_t * src = pixels;
+    if (!keyframe) {
+        for (size_t i = 0; i < record_size; i++)
+            record_delta[i] = pixels[i] ^ record_prev[i];
+        src = record_delta;
+    }
+    memcpy(record_prev, pixels, record_size);
+
+    if (keyframe) {
+        if (record_n_index >= record_index_capacity) {
+            record_index_capacity = MAX(record_index_capacity * 2, 64);
+            record_index = realloc(record_index, record_index_capacity * sizeof *record_index);
+            if (record_index == NULL) MEMFAIL();
+        }
+        record_index[record_n_index++] = (struct output_record_index) {
+            .frame = record_frame,
+            .offset = record_offset,
+        };
+    }
+
+    struct output_record_frame frame = {
+        .magic = OUTPUT_RECORD_FRAME_MAGIC,
+        .flags = keyframe ? OUTPUT_RECORD_KEYFRAME : 0,
+        .frame = record_frame++,
+        .timestamp_us = (SDL_GetPerformanceCounter() - record_start) * 1e6 / SDL_GetPerformanceFrequency(),
+        .size = lz4_compress(src, record_size, record_out),
+    };
+    record_write(&frame, sizeof frame);
+    record_write(record_out, frame.size);
+}
+
+void output_record_close() {
+    if (record_file == NULL) return;
+
+    struct output_record_footer footer = {
+        .index_offset = record_offset,
+        .n_entries = record_n_index,
+        .magic = OUTPUT_RECORD_INDEX_MAGIC,
+    };
+    record_write(record_index, record_n_index * sizeof *record_index);
+    record_write(&footer, sizeof footer);
+    if (fclose(record_file) != 0)
+        PERROR("Unable to close recording");
+    INFO("Recorded %lu frames", (unsigned long) record_frame);
+
+    record_file = NULL;
+    free(record_prev);
+    free(record_delta);
+    free(record_out);
+    free(record_index);
+    record_prev = record_delta = record_out = NULL;
+    record_index = NULL;
+    record_index_capacity = 0;
+}
+
+//
+
+// Decode the frame at `replay_offset` into `replay_pixels` and move on to the next one
+static int replay_decode(struct output_record_frame * frame) {
+    if (replay_end - replay_offset < sizeof *frame) return -1;
+    memcpy(frame, replay_map + replay_offset, sizeof *frame);
+    if (frame->magic != OUTPUT_RECORD_FRAME_MAGIC || replay_end - replay_offset - sizeof *frame < frame->size) {
+        ERROR("Corrupt frame in recording at offset %zu", replay_offset);
+        return -1;
+    }
+
+    const uint8_t * data = replay_map + replay_offset + sizeof *frame;
+    if (frame->flags & OUTPUT_RECORD_KEYFRAME) {
+        if (lz4_decompress(data, frame->size, replay_pixels, replay_size) != (long) replay_size) goto corrupt;
+    } else {
+        if (lz4_decompress(data, frame->size, replay_delta, replay_size) != (long) replay_size) goto corrupt;
+        for (size_t i = 0; i < replay_size; i++)
+            replay_pixels[i] ^= replay_delta[i];
+    }
+
+    replay_offset += sizeof *frame + frame->size;
+    return 0;
+
+corrupt:
+    ERROR("Unable to decompress frame %lu of recording", (unsigned long) frame->frame);
+    return -1;
+}
+
+// Recordings which were never closed have no index, so find the keyframes ourselves
+static int replay_scan_index() {
+    size_t capacity = 0;
+    replay_n_index = 0;
+    replay_end = replay_map_size;
+    for (size_t offset = replay_start; replay_map_size - offset >= sizeof(struct output_record_frame);) {
+        struct output_record_frame frame;
+        memcpy(&frame, replay_map + offset, sizeof frame);
+        if (frame.magic != OUTPUT_RECORD_FRAME_MAGIC || replay_map_size - offset - sizeof frame < frame.size)
+            break;
+        if (frame.flags & OUTPUT_RECORD_KEYFRAME) {
+            if (replay_n_index >= capacity) {
+                capacity = MAX(capacity * 2, 64);
+                replay_index = realloc(replay_index, capacity * sizeof *replay_index);
+                if (replay_index == NULL) MEMFAIL();
+            }
+            replay_index[replay_n_index++] = (struct output_record_index) { .frame = frame.frame, .offset = offset };
+        }
+        offset += sizeof frame + frame.size;
+        replay_end = offset;
+    }
+    WARN("Recording has no index (was it closed?); found %zu keyframes", replay_n_index);
+    return 0;
+}
+
+static int replay_read_index() {
+    struct output_record_footer footer;
+    if (replay_map_size - replay_start < sizeof footer)
+        return replay_scan_index();
+    memcpy(&footer, replay_map + replay_map_size - sizeof footer, sizeof footer);
+    if (memcmp(footer.magic, OUTPUT_RECORD_INDEX_MAGIC, sizeof footer.magic) != 0)
+        return replay_scan_index();
+
+    size_t index_size = footer.n_entries * sizeof *replay_index;
+    if (footer.index_offset < replay_start || footer.index_offset + index_size + sizeof footer != replay_map_size) {
+        ERROR("Corrupt recording index");
+        return -1;
+    }
+    replay_n_index = footer.n_entries;
+    replay_index = malloc(MAX(index_size, 1));
+    if (replay_index == NULL) MEMFAIL();
+    memcpy(replay_index, replay_map + footer.index_offset, index_size);
+    replay_end = footer.index_offset;
+
+    // replay_seek jumps straight to these offsets
+    for (size_t i = 0; i < replay_n_index; i++) {
+        uint64_t offset = replay_index[i].offset;
+        if (offset < replay_start || offset > replay_end
+            || replay_end - offset < sizeof(struct output_record_frame)) {
+            WARN("Recording index entry %zu is out of bounds; rebuilding the index", i);
+            free(replay_index);
+            replay_index = NULL;
+            return replay_scan_index();
+        }
+    }
+    return 0;
+}
+
+// Start at the last keyframe at or before `seek`, and decode up to it
+static int replay_seek(uint64_t seek) {
+    size_t lo = 0, hi = replay_n_index;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (replay_index[mid].frame <= seek) lo = mid;
+        else hi = mid;
+    }
+    if (replay_n_index == 0 || replay_index[lo].frame > seek) {
+        replay_offset = replay_start;
+        return 0;
+    }
+
+    replay_offset = replay_index[lo].offset;
+    while (true) {
+        if (replay_end - replay_offset < sizeof(struct output_record_frame)) return -1;
+        struct output_record_frame next;
+        memcpy(&next, replay_map + replay_offset, sizeof next);
+        if (next.frame >= seek) return 0;
+
+        struct output_record_frame frame;
+        if (replay_decode(&frame) < 0) return -1;
+    }
+}
+
+// The recording has to line up with the configured devices pixel for pixel
+static int replay_check_devices(const struct output_record_header * header) {
+    size_t n_devices;
+    size_t n_pixels = record_count_pixels(&n_devices);
+    if (header->n_devices != n_devices || header->n_pixels != n_pixels) {
+        ERROR("Recording has %u devices with %u pixels, but %zu devices with %zu pixels are configured",
+              header->n_devices, header->n_pixels, n_devices, n_pixels);
+        return -1;
+    }
+
+    const uint8_t * ptr = replay_map + sizeof *header;
+    for (struct output_device * dev = output_device_head; dev; dev = dev->next) {
+        struct output_record_device entry;
+        memcpy(&entry, ptr, sizeof entry);
+        ptr += sizeof entry;
+        if (entry.length != dev->pixels.length) {
+            ERROR("Recorded device '%.*s' has %u pixels, but '%s' has %zu", OUTPUT_RECORD_NAME_SIZE,
+                  entry.name, entry.length, dev->ui_name, dev->pixels.length);
+            return -1;
+        }
+        if (dev->ui_name != NULL && strncmp(entry.name, dev->ui_name, sizeof entry.name) != 0)
+            WARN("Replaying recorded device '%.*s' on '%s'", OUTPUT_RECORD_NAME_SIZE, entry.name, dev->ui_name);
+    }
+    return 0;
+}
+
+int output_replay_open(const char * path, bool loop, uint64_t seek) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        PERROR("Unable to open recording '%s'", path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(struct output_record_header)) {
+        ERROR("Recording '%s' is too short", path);
+        close(fd);
+        return -1;
+    }
+    replay_map_size = st.st_size;
+    replay_map = mmap(NULL, replay_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (replay_map == MAP_FAILED) {
+        replay_map = NULL;
+        PERROR("Unable to map recording '%s'", path);
+        return -1;
+    }
+
+    struct output_record_header header;
+    memcpy(&header, replay_map, sizeof header);
+    replay_start = sizeof header + header.n_devices * sizeof(struct output_record_device);
+    if (memcmp(header.magic, OUTPUT_RECORD_MAGIC, sizeof header.magic) != 0 || replay_start > replay_map_size) {
+        ERROR("'%s' is not a recording", path);
+        goto fail;
+    }
+    if (replay_check_devices(&header) < 0) goto fail;
+    if (replay_read_index() < 0) goto fail;
+
+    replay_size = header.n_pixels * sizeof(SDL_Color);
+    replay_pixels = calloc(1, MAX(replay_size, 1));
+    replay_delta = calloc(1, MAX(replay_size, 1));
+    if (replay_pixels == NULL || replay_delta == NULL) MEMFAIL();
+    replay_loop = loop;
+    replay_restart = true;
+
+    if (replay_seek(seek) < 0) {
+        ERROR("Unable to seek to frame %lu of '%s'", (unsigned long) seek, path);
+        goto fail;
+    }
+
+    INFO("Replaying '%s' from frame %lu", path, (unsigned long) seek);
+    return 0;
+
+fail:
+    output_replay_close();
+    return -1;
+}
+
+void output_replay_close() {
+    if (replay_map != NULL)
+        munmap(replay_map, replay_map_size);
+    replay_map = NULL;
+    replay_map_size = 0;
+    free(replay_pixels);
+    free(replay_delta);
+    free(replay_index);
+    replay_pixels = replay_delta = NULL;
+    replay_index = NULL;
+    replay_n_index = 0;
+}
+
+int output_replay_frame(SDL_Color * colors) {
+    if (replay_map == NULL) return -1;
+
+    if (replay_end - replay_offset < sizeof(struct output_record_frame)) {
+        if (!replay_loop) return -1;
+        replay_offset = replay_start;
+        replay_restart = true;
+    }
+
+    struct output_record_frame frame;
+    if (replay_decode(&frame) < 0) return -1;
+
+    // Play the frames back with the same timing they were recorded with
+    Uint64 now = SDL_GetPerformanceCounter();
+    double ticks_per_us = SDL_GetPerformanceFrequency() / 1e6;
+    if (replay_restart) {
+        replay_t0 = now;
+        replay_ts0 = frame.timestamp_us;
+        replay_restart = false;
+    }
+    double wait_us = (frame.timestamp_us - replay_ts0) - (now - replay_t0) / ticks_per_us;
+    if (wait_us > 1000)
+        SDL_Delay(wait_us / 1000);
+
+    memcpy(colors, replay_pixels, replay_size);
+    return 0;
+}
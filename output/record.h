@@ -0,0 +1,68 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Recordings of the sampled pixels of every output device.
+//
+// The file starts with an `output_record_header` and `n_devices` `output_record_device`
+// entries, followed by frames. Each frame is an `output_record_frame` followed by
+// `size` bytes of LZ4 block data. Keyframes decompress to the RGBA pixels of every device,
+// back to back; other frames decompress to the XOR of the pixels with the previous frame.
+//
+// When the recording is closed, an index of the keyframes (`output_record_index` entries)
+// and an `output_record_footer` are appended. Recordings without a footer (e.g. after a
+// crash) can still be replayed; the index is then rebuilt by scanning the frames.
+
+#define OUTPUT_RECORD_MAGIC "RADREC01"
+#define OUTPUT_RECORD_FRAME_MAGIC 0x4D415246 // "FRAM"
+#define OUTPUT_RECORD_INDEX_MAGIC "RADIDX01"
+#define OUTPUT_RECORD_NAME_SIZE 32
+
+#define OUTPUT_RECORD_KEYFRAME 0x1
+
+struct output_record_header {
+    char magic[8];
+    uint32_t n_devices;
+    uint32_t n_pixels;
+};
+
+struct output_record_device {
+    char name[OUTPUT_RECORD_NAME_SIZE];
+    uint32_t length;
+    uint32_t reserved;
+};
+
+struct output_record_frame {
+    uint32_t magic;
+    uint32_t flags;
+    uint64_t frame;
+    uint64_t timestamp_us; // Since the start of the recording
+    uint32_t size;
+    uint32_t reserved;
+};
+
+struct output_record_index {
+    uint64_t frame;
+    uint64_t offset;
+};
+
+struct output_record_footer {
+    uint64_t index_offset;
+    uint64_t n_entries;
+    char magic[8];
+};
+
+// Record the devices on `output_device_head`. `path` is formatted with strftime
+int output_record_open(const char * path, int keyframe_interval);
+void output_record_close();
+// `colors` holds the pixels of every device on `output_device_head`, back to back
+void output_record_frame(const SDL_Color * colors);
+
+// Replay a recording made with the devices on `output_device_head`, starting at frame `seek`
+int output_replay_open(const char * path, bool loop, uint64_t seek);
+void output_replay_close();
+// Waits until the next frame is due and decodes it into `colors`.
+// Returns -1 at the end of the recording (unless looping).
+int output_replay_frame(SDL_Color * colors);
@@ -0,0 +1,139 @@
+#include "output/shm.h"
+
+#include <fcntl.h>
+#include <SDL2/SDL.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "output/config.h"
+#include "output/slice.h"
+#include "ui/render.h"
+#include "util/config.h"
+#include "util/err.h"
+#include "util/math.h"
+
+#define OUTPUT_SHM_ALIGN 64
+
+static struct output_shm_header * header = NULL;
+static size_t map_size = 0;
+static char * shm_name = NULL;
+static uint64_t frame = 0;
+
+static size_t align(size_t x) {
+    return (x + OUTPUT_SHM_ALIGN - 1) & ~(size_t) (OUTPUT_SHM_ALIGN - 1);
+}
+
+static struct output_shm_slot * shm_slot(uint64_t n) {
+    return (void *) ((uint8_t *) header + header->slots_offset + (n % header->n_slots) * header->slot_size);
+}
+
+int output_shm_init() {
+    size_t width = config.pattern.master_width;
+    size_t height = config.pattern.master_height;
+
+    size_t n_devices = 0;
+    size_t n_pixels = 0;
+    for (struct output_device * dev = output_device_head; dev; dev = dev->next) {
+        n_devices++;
+        n_pixels += dev->pixels.length;
+    }
+
+    size_t n_slots = MAX(output_config.shm.n_slots, 2);
+    size_t slots_offset = align(sizeof *header + n_devices * sizeof(struct output_shm_device));
+    size_t slot_size = align(sizeof(struct output_shm_slot) + (width * height + n_pixels) * 4);
+    map_size = slots_offset + n_slots * slot_size;
+
+    shm_name = strdup(output_config.shm.name);
+    if (shm_name == NULL) MEMFAIL();
+    shm_unlink(shm_name);
+    int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        PERROR("Unable to create shared memory '%s'", shm_name);
+        goto fail;
+    }
+    if (ftruncate(fd, map_size) < 0) {
+        PERROR("Unable to size shared memory '%s'", shm_name);
+        close(fd);
+        goto fail;
+    }
+    header = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        header = NULL;
+        PERROR("Unable to map shared memory '%s'", shm_name);
+        goto fail;
+    }
+
+    header->magic = OUTPUT_SHM_MAGIC;
+    header->version = OUTPUT_SHM_VERSION;
+    header->width = width;
+    header->height = height;
+    header->n_devices = n_devices;
+    header->n_pixels = n_pixels;
+    header->n_slots = n_slots;
+    header->slot_size = slot_size;
+    header->slots_offset = slots_offset;
+    header->closed = 0;
+    header->frame = 0;
+
+    struct output_shm_device * entry = (void *) (header + 1);
+    size_t offset = 0;
+    for (struct output_device * dev = output_device_head; dev; dev = dev->next) {
+        snprintf(entry->name, sizeof entry->name, "%s", dev->ui_name != NULL ? dev->ui_name : "");
+        entry->offset = offset;
+        entry->length = dev->pixels.length;
+        offset += dev->pixels.length;
+        entry++;
+    }
+
+    INFO("Exporting frames to shared memory '%s' (%zu bytes)", shm_name, map_size);
+    return 0;
+
+fail:
+    shm_unlink(shm_name);
+    free(shm_name);
+    shm_name = NULL;
+    return -1;
+}
+
+void output_shm_term() {
+    if (header != NULL) {
+        header->closed = 1;
+        munmap(header, map_size);
+        header = NULL;
+    }
+    if (shm_name != NULL) {
+        shm_unlink(shm_name);
+        free(shm_name);
+        shm_name = NULL;
+    }
+}
+
+void output_shm_export(struct render * render, const SDL_Color * colors) {
+    if (header == NULL) return;
+
+    frame++;
+    struct output_shm_slot * slot = shm_slot(frame);
+    uint32_t seq = slot->seq;
+
+    // Odd while we write
+    slot->seq = seq + 1;
+    SDL_MemoryBarrierRelease();
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    slot->frame = frame;
+    slot->timestamp_us = ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+
+    uint8_t * data = (uint8_t *) (slot + 1);
+    size_t readback_size = header->width * header->height * 4;
+    if (render != NULL)
+        memcpy(data, render->pixels, readback_size);
+    memcpy(data + readback_size, colors, header->n_pixels * sizeof *colors);
+
+    SDL_MemoryBarrierRelease();
+    slot->seq = seq + 2;
+    header->frame = frame;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+// Shared-memory export of rendered frames, for external drivers and visualizers.
+//
+// The segment (`shm_open(name)`) starts with an `output_shm_header`, followed by
+// `n_devices` `output_shm_device` entries, followed by `n_slots` slots of `slot_size`
+// bytes each, starting at `slots_offset`. Each slot is an `output_shm_slot` followed by
+// the master readback (`width * height` RGBA pixels, bottom row first) and then the
+// sampled RGBA pixels of every device, back to back.
+//
+// Frame `n` is written to slot `n % n_slots`, and `frame` in the header is the newest
+// complete frame. Each slot is a seqlock: `seq` is odd while the slot is being written.
+// To read a frame, read `seq`, copy the slot, then read `seq` again; the copy is
+// consistent if both reads are the same even number.
+//
+// When the output configuration is reloaded, `closed` is set and the segment is
+// recreated, so readers should reopen it.
+
+#define OUTPUT_SHM_MAGIC 0x53444152 // "RADS"
+#define OUTPUT_SHM_VERSION 1
+#define OUTPUT_SHM_NAME_SIZE 32
+
+struct output_shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t n_devices;
+    uint32_t n_pixels;
+    uint32_t n_slots;
+    uint32_t slot_size;
+    uint32_t slots_offset;
+    volatile uint32_t closed;
+    volatile uint64_t frame;
+};
+
+struct output_shm_device {
+    char name[OUTPUT_SHM_NAME_SIZE];
+    uint32_t offset; // In pixels, from the start of the device pixels in each slot
+    uint32_t length;
+};
+
+struct output_shm_slot {
+    volatile uint32_t seq;
+    uint32_t reserved;
+    volatile uint64_t frame;
+    volatile uint64_t timestamp_us; // CLOCK_MONOTONIC
+};
+
+struct render;
+struct SDL_Color;
+
+int output_shm_init();
+void output_shm_term();
+
+// `colors` holds the pixels of every device, back to back. If `render` is given,
+// it must be frozen; if not (e.g. during a replay, or with `[pattern] led_only`), the readback is
+// left as it was.
+void output_shm_export(struct render * render, const struct SDL_Color * colors);
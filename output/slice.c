@@ -159,15 +159,7 @@ int output_device_arrange_grid(struct output_device * dev, int width, int height
     return 0;
 }
 
-int output_render(struct render * render) {
-    render_freeze(render);
-    for (struct output_device * dev = output_device_head; dev; dev = dev->next) {
-        if (!dev->active) continue;
-        for (size_t i = 0; i < dev->pixels.length; i++)
-            dev->pixels.colors[i] = render_sample(render, dev->pixels.xs[i], dev->pixels.ys[i]);
-    }
-    render_thaw(render);
-    output_render_count++;
-    return 0;
+void output_device_sample(const struct output_device * dev, struct render * render, SDL_Color * colors) {
+    for (size_t i = 0; i < dev->pixels.length; i++)
+        colors[i] = render_sample(render, dev->pixels.xs[i], dev->pixels.ys[i]);
 }
-
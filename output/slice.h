@@ -36,6 +36,12 @@ struct output_device {
     char * ui_name;
 };
 
+// Exact round(c * a / 255) without any division
+static inline uint8_t output_premultiply(uint8_t c, uint8_t a) {
+    unsigned int x = c * a + 128;
+    return (x + (x >> 8)) >> 8;
+}
+
 extern struct output_device * output_device_head;
 extern unsigned int output_render_count;
 
@@ -43,5 +49,5 @@ extern unsigned int output_render_count;
 int output_device_arrange(struct output_device * dev);
 int output_device_arrange_grid(struct output_device * dev, int width, int height);
 
-// Render all of the output device pixel buffers
-int output_render(struct render * render);
+// Sample the device's pixels into `colors`. The render must be frozen.
+void output_device_sample(const struct output_device * dev, struct render * render, SDL_Color * colors);
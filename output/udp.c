@@ -0,0 +1,68 @@
+#define _GNU_SOURCE
+#include "output/udp.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "util/err.h"
+
+#ifndef __LINUX__
+// sendmmsg is Linux-only, so elsewhere the batch is sent one datagram at a time
+struct mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+#endif
+
+void udp_batch_init(struct udp_batch * batch, size_t capacity) {
+    memset(batch, 0, sizeof *batch);
+    batch->capacity = capacity;
+    batch->addrs = calloc(capacity, sizeof *batch->addrs);
+    batch->iovs = calloc(capacity, sizeof *batch->iovs);
+    batch->msgs = calloc(capacity, sizeof *batch->msgs);
+    if (batch->addrs == NULL || batch->iovs == NULL || batch->msgs == NULL) MEMFAIL();
+}
+
+void udp_batch_term(struct udp_batch * batch) {
+    free(batch->addrs);
+    free(batch->iovs);
+    free(batch->msgs);
+    memset(batch, 0, sizeof *batch);
+}
+
+int udp_batch_add(struct udp_batch * batch, const struct sockaddr_in * addr, const void * data, size_t length) {
+    if (batch->length >= batch->capacity) return -1;
+
+    size_t i = batch->length++;
+    batch->addrs[i] = *addr;
+    batch->iovs[i].iov_base = (void *) data;
+    batch->iovs[i].iov_len = length;
+
+    struct msghdr * hdr = &batch->msgs[i].msg_hdr;
+    memset(hdr, 0, sizeof *hdr);
+    hdr->msg_name = &batch->addrs[i];
+    hdr->msg_namelen = sizeof batch->addrs[i];
+    hdr->msg_iov = &batch->iovs[i];
+    hdr->msg_iovlen = 1;
+    return 0;
+}
+
+int udp_batch_send(int fd, struct udp_batch * batch) {
+    size_t sent = 0;
+    while (sent < batch->length) {
+#ifdef __LINUX__
+        int rc = sendmmsg(fd, &batch->msgs[sent], batch->length - sent, 0);
+#else
+        int rc = sendmsg(fd, &batch->msgs[sent].msg_hdr, 0) < 0 ? -1 : 1;
+#endif
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            batch->length = 0;
+            return sent > 0 ? (int) sent : -1;
+        }
+        sent += rc;
+    }
+    batch->length = 0;
+    return sent;
+}
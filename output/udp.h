@@ -0,0 +1,24 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+// Batch of UDP datagrams to be sent with as few system calls as possible
+// (a single sendmmsg on Linux; one sendto per datagram elsewhere)
+struct udp_batch {
+    size_t length;
+    size_t capacity;
+    struct sockaddr_in * addrs;
+    struct iovec * iovs;
+    struct mmsghdr * msgs;
+};
+
+void udp_batch_init(struct udp_batch * batch, size_t capacity);
+void udp_batch_term(struct udp_batch * batch);
+
+// `data` is not copied, so it must stay valid until the batch is sent
+int udp_batch_add(struct udp_batch * batch, const struct sockaddr_in * addr, const void * data, size_t length);
+
+// Returns the number of datagrams sent and empties the batch
+int udp_batch_send(int fd, struct udp_batch * batch);
@@ -1,8 +1,11 @@
 #include "pattern/crossfader.h"
+#include "pattern/texpool.h"
+#include "pattern/soft.h"
 #include "util/glsl.h"
 #include "util/string.h"
 #include "util/err.h"
 #include "util/config.h"
+#include "main.h"
 #include <string.h>
 
 void crossfader_init(struct crossfader * crossfader) {
@@ -12,48 +15,62 @@ void crossfader_init(struct crossfader * crossfader) {
 
     crossfader->position = 0.5;
 
+    if(soft_enabled) return;
+
     crossfader->shader = load_shader("resources/crossfader.glsl");
     if(crossfader->shader == 0) FAIL("Unable to load crossfader shader:\n%s", load_shader_error);
 
-    // Render targets
-    glGenFramebuffersEXT(1, &crossfader->fb);
-    glGenTextures(1, &crossfader->tex_output);
-    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
-
-    glBindTexture(GL_TEXTURE_2D, crossfader->tex_output);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, config.pattern.master_width, config.pattern.master_height, 0, 
-                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // Look up uniforms once, and set the ones that never change
+    crossfader->loc_intensity = glGetUniformLocationARB(crossfader->shader, "iIntensity");
+    crossfader->loc_left_on_top = glGetUniformLocationARB(crossfader->shader, "iLeftOnTop");
+    crossfader->loc_resolution = glGetUniformLocationARB(crossfader->shader, "iResolution");
+    crossfader->loc_sampled = glGetUniformLocationARB(crossfader->shader, "iSampled");
+    glUseProgramObjectARB(crossfader->shader);
+    GLint loc;
+    loc = glGetUniformLocationARB(crossfader->shader, "iFrameLeft");
+    glUniform1iARB(loc, 0);
+    loc = glGetUniformLocationARB(crossfader->shader, "iFrameRight");
+    glUniform1iARB(loc, 1);
+    loc = glGetUniformLocationARB(crossfader->shader, "iCoords");
+    glUniform1iARB(loc, 2);
+    glUseProgramObjectARB(0);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, crossfader->fb);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D,
-                              crossfader->tex_output, 0);
-    glClear(GL_COLOR_BUFFER_BIT);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+    crossfader->tex_output = texpool_get(config.pattern.master_width, config.pattern.master_height);
+    texpool_clear(&crossfader->tex_output, 1);
 }
 
 void crossfader_term(struct crossfader * crossfader) {
     GLenum e;
 
-    glDeleteTextures(1, &crossfader->tex_output);
-    glDeleteFramebuffersEXT(1, &crossfader->fb);
-    glDeleteObjectARB(crossfader->shader);
-    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+    if(!soft_enabled) {
+        texpool_put(crossfader->tex_output);
+        unload_shader(crossfader->shader);
+        if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+    }
 
     memset(crossfader, 0, sizeof *crossfader);
 }
 
-void crossfader_render(struct crossfader * crossfader, GLuint left, GLuint right) {
+void crossfader_render(struct crossfader * crossfader, const struct deck * left_deck, const struct deck * right_deck,
+                       bool canvas) {
     GLenum e;
+
+    if(soft_enabled) {
+        // Blend straight into the buffer the output thread samples; there is nothing to read back.
+        // Like render_readback, skip the frame if the output thread has it.
+        if(SDL_TryLockMutex(render.mutex) == 0) {
+            soft_crossfade(render.pixels, config.pattern.master_width, config.pattern.master_height,
+                           left_deck->frame_output, right_deck->frame_output,
+                           crossfader->position, crossfader->left_on_top);
+            SDL_UnlockMutex(render.mutex);
+        }
+        goto done;
+    }
+
+    GLuint left = left_deck->tex_output;
+    GLuint right = right_deck->tex_output;
     glLoadIdentity();
-    glViewport(0, 0, config.pattern.master_width, config.pattern.master_height);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, crossfader->fb);
     glUseProgramObjectARB(crossfader->shader);
 
     glActiveTexture(GL_TEXTURE0);
@@ -62,30 +79,35 @@ void crossfader_render(struct crossfader * crossfader, GLuint left, GLuint right
     glBindTexture(GL_TEXTURE_2D, right);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
-    GLint loc;
-    loc = glGetUniformLocationARB(crossfader->shader, "iResolution");
-    glUniform2fARB(loc, config.pattern.master_width, config.pattern.master_height);
-    loc = glGetUniformLocationARB(crossfader->shader, "iIntensity");
-    glUniform1fARB(loc, crossfader->position);
-    loc = glGetUniformLocationARB(crossfader->shader, "iFrameLeft");
-    glUniform1iARB(loc, 0);
-    loc = glGetUniformLocationARB(crossfader->shader, "iFrameRight");
-    glUniform1iARB(loc, 1);
-    loc = glGetUniformLocationARB(crossfader->shader, "iLeftOnTop");
-    glUniform1iARB(loc, crossfader->left_on_top);
+    glUniform1fARB(crossfader->loc_intensity, crossfader->position);
+    glUniform1iARB(crossfader->loc_left_on_top, crossfader->left_on_top);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
-    glClear(GL_COLOR_BUFFER_BIT);
-    glBegin(GL_QUADS);
-    glVertex2d(-1, -1);
-    glVertex2d(-1, 1);
-    glVertex2d(1, 1);
-    glVertex2d(1, -1);
-    glEnd();
+    // Only shade the points the output devices sample
+    bool sampled = config.pattern.led_only && render_sample_begin(&render);
+    if(sampled) {
+        glUniform2fARB(crossfader->loc_resolution, render.sample_width, render.sample_height);
+        glUniform1iARB(crossfader->loc_sampled, 1);
+        glClear(GL_COLOR_BUFFER_BIT);
+        render_draw(&render, false);
+        if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+    }
+
+    if(canvas || !sampled) {
+        glViewport(0, 0, config.pattern.master_width, config.pattern.master_height);
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, texpool_framebuffer());
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D,
+                                  crossfader->tex_output, 0);
+        glUniform2fARB(crossfader->loc_resolution, config.pattern.master_width, config.pattern.master_height);
+        glUniform1iARB(crossfader->loc_sampled, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        render_draw(&render, config.pattern.sparse);
+    }
 
     glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
+done:
     if(crossfader->position == 1.) {
         crossfader->left_on_top = true;
     } else if(crossfader->position == 0.) {
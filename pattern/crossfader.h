@@ -10,8 +10,11 @@ struct crossfader {
     bool left_on_top;
 
     GLhandleARB shader;
+    GLint loc_intensity;
+    GLint loc_left_on_top;
+    GLint loc_resolution;
+    GLint loc_sampled;
     GLuint tex_output;
-    GLuint fb;
 
     float position;
     uint8_t * rb_buf;
@@ -19,4 +22,6 @@ struct crossfader {
 
 void crossfader_init(struct crossfader * crossfader);
 void crossfader_term(struct crossfader * crossfader);
-void crossfader_render(struct crossfader * crossfader, GLuint left, GLuint right);
+// `canvas`: the full canvas is needed (e.g. for the UI), even if `[pattern] led_only` renders just the sampled points
+void crossfader_render(struct crossfader * crossfader, const struct deck * left, const struct deck * right,
+                       bool canvas);
@@ -1,4 +1,7 @@
 #include "pattern/deck.h"
+#include "pattern/loader.h"
+#include "pattern/texpool.h"
+#include "pattern/soft.h"
 #include "util/err.h"
 #include "util/config.h"
 #include "util/string.h"
@@ -9,40 +12,48 @@
 #define GL_GLEXT_PROTOTYPES
 #include <SDL2/SDL_opengl.h>
 #include <assert.h>
+#include <math.h>
 
-void deck_init(struct deck * deck) {
-    GLenum e;
+// Resolution scales a deck can step through when it's over budget
+static const float scale_steps[] = {1., 0.75, 0.5, 0.35, 0.25};
+#define N_SCALE_STEPS ((int) (sizeof scale_steps / sizeof *scale_steps))
+
+static int timer_queries = -1;
 
+void deck_init(struct deck * deck) {
     memset(deck, 0, sizeof *deck);
     deck->pattern = calloc(config.deck.n_patterns, sizeof *deck->pattern);
     if(deck->pattern == NULL) MEMFAIL();
+    deck->generation = calloc(config.deck.n_patterns, sizeof *deck->generation);
+    if(deck->generation == NULL) MEMFAIL();
+
+    deck->width = config.pattern.master_width;
+    deck->height = config.pattern.master_height;
+    if(soft_enabled) {
+        deck->frame_input = soft_frame_new(deck->width, deck->height);
+        return;
+    }
+
+    deck->tex_input = texpool_get(config.pattern.master_width, config.pattern.master_height);
+    texpool_clear(&deck->tex_input, 1);
 
-    glGenTextures(1, &deck->tex_input);
-    glGenFramebuffersEXT(1, &deck->fb_input);
-    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
-
-    glBindTexture(GL_TEXTURE_2D, deck->tex_input);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, config.pattern.master_width, config.pattern.master_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
-
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, deck->fb_input);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D,
-                              deck->tex_input, 0);
-    glClear(GL_COLOR_BUFFER_BIT);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-
-    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+    if(timer_queries < 0) {
+        const char * extensions = (const char *) glGetString(GL_EXTENSIONS);
+        timer_queries = extensions != NULL && strstr(extensions, "GL_ARB_timer_query") != NULL;
+        if(!timer_queries && config.pattern.render_budget > 0)
+            WARN("Timer queries not supported; rendering every deck at full resolution");
+    }
+    if(timer_queries && config.pattern.render_budget > 0)
+        glGenQueries(2, deck->timer);
 }
 
 void deck_term(struct deck * deck) {
-    glDeleteTextures(1, &deck->tex_input);
-    glDeleteFramebuffersEXT(1, &deck->fb_input);
-    glDeleteTextures(1, &deck->tex_output);
+    if(soft_enabled) {
+        soft_frame_free(deck->frame_input);
+    } else {
+        texpool_put(deck->tex_input);
+        if(deck->timer[0] != 0) glDeleteQueries(2, deck->timer);
+    }
 
     for(int i = 0; i < config.deck.n_patterns; i++) {
         if(deck->pattern[i] != NULL) {
@@ -51,13 +62,13 @@ void deck_term(struct deck * deck) {
             deck->pattern[i] = NULL;
         }
     }
+    free(deck->pattern);
+    free(deck->generation);
     memset(deck, 0, sizeof *deck);
 }
 
-int deck_load_pattern(struct deck * deck, int slot, const char * prefix, float intensity) {
+void deck_replace_pattern(struct deck * deck, int slot, struct pattern * p, float intensity) {
     assert(slot >= 0 && slot < config.deck.n_patterns);
-    struct pattern * p = calloc(1, sizeof *p);
-
     if(intensity < 0) {
         if (deck->pattern[slot])
             intensity = deck->pattern[slot]->intensity;
@@ -65,39 +76,104 @@ int deck_load_pattern(struct deck * deck, int slot, const char * prefix, float i
             intensity = 0.;
     }
 
+    if(deck->pattern[slot]) {
+        pattern_term(deck->pattern[slot]);
+        free(deck->pattern[slot]);
+    }
+    deck->pattern[slot] = p;
+    if(p != NULL) {
+        p->intensity = intensity;
+        pattern_resize(p, deck->width, deck->height);
+    }
+}
+
+// Add a load (or, with a NULL prefix, an unload) of `slot` to a background batch
+static struct loader_item * deck_queue_item(struct loader_item ** batch, struct deck * deck, int slot, const char * prefix, float intensity) {
+    struct loader_item * item = calloc(1, sizeof *item);
+    if(item == NULL) MEMFAIL();
+    if(prefix != NULL) {
+        item->prefix = strdup(prefix);
+        if(item->prefix == NULL) MEMFAIL();
+    }
+    item->deck = deck;
+    item->slot = slot;
+    item->intensity = intensity;
+    item->next = *batch;
+    *batch = item;
+    return item;
+}
+
+int deck_load_pattern(struct deck * deck, int slot, const char * prefix, float intensity) {
+    assert(slot >= 0 && slot < config.deck.n_patterns);
+
     if(prefix[0] == '\0') {
         if(deck->pattern[slot]) {
             prefix = deck->pattern[slot]->name;
         } else return -1;
     }
 
+    if(loader_running()) {
+        // Swapped in by loader_swap once it has compiled
+        struct loader_item * batch = NULL;
+        deck_queue_item(&batch, deck, slot, prefix, intensity);
+        if(loader_queue(batch) == 0) return 0;
+        WARN("Pattern loader is busy; loading '%s' synchronously", prefix);
+    }
+
+    struct pattern * p = calloc(1, sizeof *p);
+    if(p == NULL) MEMFAIL();
     int result = pattern_init(p, prefix);
     if(result != 0) {
+        pattern_term(p);
         free(p);
         return result;
     }
-    if(deck->pattern[slot]) {
-        pattern_term(deck->pattern[slot]);
-        free(deck->pattern[slot]);
-    }
-    deck->pattern[slot] = p;
-    p->intensity = intensity;
+    deck->generation[slot]++;
+    deck_replace_pattern(deck, slot, p, intensity);
     return 0;
 }
 
 void deck_unload_pattern(struct deck * deck, int slot) {
     assert(slot >= 0 && slot < config.deck.n_patterns);
-    if(deck->pattern[slot]) {
-        pattern_term(deck->pattern[slot]);
-        free(deck->pattern[slot]);
-        deck->pattern[slot] = NULL;
+    deck->generation[slot]++;
+    deck_replace_pattern(deck, slot, NULL, 0.);
+}
+
+void deck_refresh(struct deck * deck, const char * name) {
+    struct loader_item * batch = NULL;
+
+    for(int slot = 0; slot < config.deck.n_patterns; slot++) {
+        struct pattern * old = deck->pattern[slot];
+        if(old == NULL || (name != NULL && strcmp(old->name, name) != 0)) continue;
+
+        if(loader_running()) {
+            deck_queue_item(&batch, deck, slot, old->name, -1)->keep_state = true;
+            continue;
+        }
+
+        struct pattern * p = calloc(1, sizeof *p);
+        if(p == NULL) MEMFAIL();
+        if(pattern_init(p, old->name) != 0) {
+            // Keep the old one running until the file is fixed
+            WARN("Error reloading pattern '%s'", old->name);
+            pattern_term(p);
+            free(p);
+            continue;
+        }
+        pattern_adopt_state(p, old);
+        deck->generation[slot]++;
+        deck_replace_pattern(deck, slot, p, -1);
     }
+
+    if(batch != NULL && loader_queue(batch) < 0)
+        WARN("Pattern loader is busy; not reloading '%s'", name != NULL ? name : "patterns");
 }
 
 struct deck_ini_data {
     struct deck * deck;
     const char * name;
     bool found;
+    struct loader_item * batch;
 };
 
 static int deck_ini_handler(void * user, const char * section, const char * name, const char * value) {
@@ -123,14 +199,23 @@ static int deck_ini_handler(void * user, const char * section, const char * name
         char * name = strsep(&entry, ":");
         float intensity = CLAMP(atof(entry), 0.0, 1.0);
 
+        if (loader_running()) {
+            deck_queue_item(&data->batch, data->deck, slot++, name, intensity);
+            continue;
+        }
+
         int rc =  deck_load_pattern(data->deck, slot++, name, intensity);
         if (rc < 0) {
             WARN("Error loading pattern '%s'", name);
             break;
         }
     }
-    while (slot < config.deck.n_patterns)
-        deck_unload_pattern(data->deck, slot++);
+    while (slot < config.deck.n_patterns) {
+        if (loader_running())
+            deck_queue_item(&data->batch, data->deck, slot++, NULL, 0.);
+        else
+            deck_unload_pattern(data->deck, slot++);
+    }
 
     free(val);
     return 1;
@@ -138,7 +223,7 @@ static int deck_ini_handler(void * user, const char * section, const char * name
 
 int deck_load_set(struct deck * deck, const char * name) {
     struct deck_ini_data data = {
-        .deck = deck, .name = name, .found = false
+        .deck = deck, .name = name, .found = false, .batch = NULL
     };
     if (data.name[0] == ':') data.name++;
 
@@ -147,18 +232,140 @@ int deck_load_set(struct deck * deck, const char * name) {
         DEBUG("No deck set named '%s'", name);
         return -1;
     }
+    // The whole set is swapped in on the same frame
+    if (data.batch != NULL && loader_queue(data.batch) < 0) {
+        WARN("Pattern loader is busy; not loading deck set '%s'", name);
+        return -1;
+    }
     return rc;
 }
 
-void deck_render(struct deck * deck) {
+// If the deck isn't `visible` (neither output nor previewed), only the patterns
+// up to the last stateful one are rendered, to keep their state current
+void deck_render(struct deck * deck, bool visible) {
+    int n = config.deck.n_patterns;
+    if(!visible) {
+        while(n > 0 && (deck->pattern[n - 1] == NULL || !deck->pattern[n - 1]->stateful))
+            n--;
+    }
+
+    if(soft_enabled) {
+        const struct soft_frame * frame = deck->frame_input;
+        for(int i = 0; i < n; i++) {
+            struct pattern * p = deck->pattern[i];
+            if(p == NULL) continue;
+            if(pattern_bypassed(p)) {
+                p->frame_output = frame;
+                continue;
+            }
+            soft_pattern_render(p, frame);
+            frame = p->frame_output;
+        }
+        deck->frame_output = frame;
+        return;
+    }
+
     deck->tex_output = deck->tex_input;
 
+    // Results are read a couple of frames late, so this never waits on the GPU
+    int t = deck->frame++ & 1;
+    if(deck->timer[t] != 0) {
+        if(deck->timer_pending[t]) {
+            GLint available = 0;
+            glGetQueryObjectiv(deck->timer[t], GL_QUERY_RESULT_AVAILABLE, &available);
+            if(available) {
+                GLuint64 ns;
+                glGetQueryObjectui64v(deck->timer[t], GL_QUERY_RESULT, &ns);
+                deck->cost = 0.9 * deck->cost + 0.1 * ns / 1e6;
+            }
+        }
+        glBeginQuery(GL_TIME_ELAPSED, deck->timer[t]);
+        deck->timer_pending[t] = true;
+    }
+
+    // The last pattern's output is only ever sampled by the output devices (and the
+    // crossfader, which is sparse too), so it can skip everything else
+    int last = -1;
+    if(config.pattern.sparse) {
+        for(int i = 0; i < n; i++) {
+            if(deck->pattern[i] != NULL && !pattern_bypassed(deck->pattern[i])) last = i;
+        }
+        if(last >= 0 && deck->pattern[last]->stateful) last = -1;
+    }
+
+    for(int i = 0; i < n; i++) {
+        struct pattern * p = deck->pattern[i];
+        if(p == NULL) continue;
+        if(pattern_bypassed(p)) {
+            // Keeps the preview correct
+            p->tex_output = deck->tex_output;
+            continue;
+        }
+        pattern_render(p, deck->tex_output, i == last);
+        deck->tex_output = p->tex_output;
+    }
+
+    if(deck->timer[t] != 0) glEndQuery(GL_TIME_ELAPSED);
+}
+
+static void deck_set_scale(struct deck * deck, int step) {
+    float old_scale = scale_steps[deck->scale_step];
+    float scale = scale_steps[step];
+    deck->scale_step = step;
+    deck->width = MAX(1, lround(config.pattern.master_width * scale));
+    deck->height = MAX(1, lround(config.pattern.master_height * scale));
     for(int i = 0; i < config.deck.n_patterns; i++) {
-        if(deck->pattern[i] != NULL) {
-            pattern_render(deck->pattern[i], deck->tex_output);
-            deck->tex_output = deck->pattern[i]->tex_output;
+        if(deck->pattern[i] != NULL) pattern_resize(deck->pattern[i], deck->width, deck->height);
+    }
+    // Assume cost goes with the number of pixels until new measurements come in
+    deck->cost *= (scale * scale) / (old_scale * old_scale);
+    DEBUG("Deck rendering at %dx%d", deck->width, deck->height);
+}
+
+void deck_autoscale(struct deck * decks, int n_decks) {
+    static int cooldown = 0;
+
+    if(config.pattern.render_budget <= 0 || timer_queries <= 0) return;
+    if(cooldown > 0) {
+        cooldown--;
+        return;
+    }
+
+    double total = 0;
+    for(int i = 0; i < n_decks; i++) {
+        total += decks[i].cost;
+    }
+
+    struct deck * target = NULL;
+    int step = 0;
+    if(total > config.pattern.render_budget) {
+        // Over budget: drop the resolution of the most expensive deck
+        for(int i = 0; i < n_decks; i++) {
+            struct deck * d = &decks[i];
+            if(d->scale_step + 1 >= N_SCALE_STEPS || scale_steps[d->scale_step + 1] < config.pattern.min_scale)
+                continue;
+            if(target == NULL || d->cost > target->cost) target = d;
+        }
+        if(target != NULL) step = target->scale_step + 1;
+    } else {
+        // Under budget: bring back the most reduced deck, if it would comfortably fit
+        for(int i = 0; i < n_decks; i++) {
+            struct deck * d = &decks[i];
+            if(d->scale_step > 0 && (target == NULL || d->scale_step > target->scale_step)) target = d;
+        }
+        if(target != NULL) {
+            step = target->scale_step - 1;
+            float ratio = scale_steps[step] / scale_steps[target->scale_step];
+            if(total + target->cost * (ratio * ratio - 1) > 0.8 * config.pattern.render_budget)
+                target = NULL;
         }
     }
+
+    if(target != NULL) {
+        deck_set_scale(target, step);
+        // Let the measurements settle before changing anything else
+        cooldown = config.ui.fps / 4;
+    }
 }
 
 int deck_save(const struct deck * deck, const char * name) {
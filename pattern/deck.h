@@ -4,15 +4,36 @@
 
 struct deck {
     struct pattern ** pattern; // e.g. deck.pattern[pattern_num]->intensity
+    unsigned int * generation; // Bumped whenever a slot is (re)loaded, to discard stale background loads
     GLuint tex_input;
-    GLuint fb_input;
-    GLuint tex_output;
+    GLuint tex_output; // Not owned: the output of the last pattern rendered, or tex_input
+
+    // Software renderer equivalents of tex_input & tex_output
+    struct soft_frame * frame_input;
+    const struct soft_frame * frame_output;
+
+    // Dynamic resolution; see deck_autoscale
+    int scale_step;
+    int width;
+    int height;
+    double cost;       // Smoothed GPU time to render the deck, in ms
+    GLuint timer[2];   // Queries for the last two frames; 0 if timer queries aren't supported
+    bool timer_pending[2];
+    unsigned int frame;
 };
 
 void deck_init(struct deck * deck);
 void deck_term(struct deck * deck);
 int deck_load_pattern(struct deck * deck, int slot, const char * prefix, float intensity);
 void deck_unload_pattern(struct deck * deck, int slot);
+// Put an already-initialized pattern (or NULL) in a slot, freeing the old one.
+// If `intensity` is negative, the old pattern's intensity is kept.
+void deck_replace_pattern(struct deck * deck, int slot, struct pattern * p, float intensity);
 int deck_load_set(struct deck * deck, const char * prefix);
-void deck_render(struct deck * deck);
+// Recompile the patterns named `name` (all of them if NULL), keeping their state
+void deck_refresh(struct deck * deck, const char * name);
+void deck_render(struct deck * deck, bool visible);
+// Adjust each deck's resolution to keep their total render time in `[pattern] render_budget`.
+// Call once a frame, after rendering.
+void deck_autoscale(struct deck * decks, int n_decks);
 int deck_save(const struct deck * deck, const char * name);
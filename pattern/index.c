@@ -0,0 +1,310 @@
+#include "pattern/index.h"
+#include "util/config.h"
+#include "util/err.h"
+#include "util/string.h"
+
+#include <SDL2/SDL.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifdef __LINUX__
+#include <fcntl.h>
+#include <sys/inotify.h>
+#endif
+
+// Sorted by name, for completion
+static struct pattern_source ** entries = NULL;
+static int n_entries = 0;
+static int entries_size = 0;
+// Looked up from the pattern loader thread too
+static SDL_SpinLock index_lock = 0;
+
+#ifdef __LINUX__
+static int inotify_fd = -1;
+static int pattern_wd = -1;
+// Every pattern is compiled with resources/header.glsl prepended (see util/glsl.c)
+static int header_wd = -1;
+#define HEADER_DIR "resources"
+#define HEADER_NAME "header.glsl"
+#endif
+
+void pattern_source_free(struct pattern_source * source) {
+    if(source == NULL) return;
+    for(int i = 0; i < source->n_passes; i++) {
+        free(source->source[i]);
+    }
+    free(source->source);
+    free(source->mtime);
+    free(source->name);
+    free(source);
+}
+
+// Splits "NAME.N.glsl" into NAME (returned, malloc'd) and N. NULL if it isn't a pattern pass.
+static char * parse_filename(const char * filename, int * pass) {
+    size_t len = strlen(filename);
+    if(len < 5 || strcmp(filename + len - 5, ".glsl") != 0) return NULL;
+    len -= 5;
+
+    size_t digits = 0;
+    while(digits < len && filename[len - digits - 1] >= '0' && filename[len - digits - 1] <= '9')
+        digits++;
+    if(digits == 0 || digits >= len - 1 || filename[len - digits - 1] != '.') return NULL;
+
+    *pass = atoi(filename + len - digits);
+    char * name = strndup(filename, len - digits - 1);
+    if(name == NULL) MEMFAIL();
+    return name;
+}
+
+// Read NAME.0.glsl, NAME.1.glsl, ... until one is missing. NULL if there isn't a pass 0.
+static struct pattern_source * source_read(const char * name) {
+    struct pattern_source * source = calloc(1, sizeof *source);
+    if(source == NULL) MEMFAIL();
+    source->name = strdup(name);
+    if(source->name == NULL) MEMFAIL();
+
+    for(;;) {
+        char * filename = rsprintf("%s%s.%d.glsl", config.pattern.dir, name, source->n_passes);
+        if(filename == NULL) MEMFAIL();
+        FILE * f = fopen(filename, "r");
+        free(filename);
+        if(f == NULL) break;
+
+        struct stat statbuf;
+        if(fstat(fileno(f), &statbuf) != 0 || S_ISDIR(statbuf.st_mode)) {
+            fclose(f);
+            break;
+        }
+        char * buffer = malloc(statbuf.st_size + 1);
+        if(buffer == NULL) MEMFAIL();
+        size_t length = fread(buffer, 1, statbuf.st_size, f);
+        buffer[length] = '\0';
+        fclose(f);
+
+        int n = source->n_passes + 1;
+        source->source = realloc(source->source, n * sizeof *source->source);
+        source->mtime = realloc(source->mtime, n * sizeof *source->mtime);
+        if(source->source == NULL || source->mtime == NULL) MEMFAIL();
+        source->source[n - 1] = buffer;
+        source->mtime[n - 1] = statbuf.st_mtime;
+        source->n_passes = n;
+    }
+
+    if(source->n_passes == 0) {
+        pattern_source_free(source);
+        return NULL;
+    }
+    return source;
+}
+
+static struct pattern_source * source_copy(const struct pattern_source * from) {
+    struct pattern_source * source = calloc(1, sizeof *source);
+    if(source == NULL) MEMFAIL();
+    source->name = strdup(from->name);
+    source->n_passes = from->n_passes;
+    source->source = calloc(from->n_passes, sizeof *source->source);
+    source->mtime = calloc(from->n_passes, sizeof *source->mtime);
+    if(source->name == NULL || source->source == NULL || source->mtime == NULL) MEMFAIL();
+    for(int i = 0; i < from->n_passes; i++) {
+        source->source[i] = strdup(from->source[i]);
+        if(source->source[i] == NULL) MEMFAIL();
+        source->mtime[i] = from->mtime[i];
+    }
+    return source;
+}
+
+// Index of `name`, or where it would be inserted. Call with index_lock held.
+static int index_find(const char * name, bool * found) {
+    int i = 0;
+    while(i < n_entries && strcmp(entries[i]->name, name) < 0) i++;
+    *found = i < n_entries && strcmp(entries[i]->name, name) == 0;
+    return i;
+}
+
+// Replace the entry for `name` with `source` (NULL to remove it), taking ownership
+static void index_set(const char * name, struct pattern_source * source) {
+    struct pattern_source * old = NULL;
+
+    SDL_AtomicLock(&index_lock);
+    bool found;
+    int i = index_find(name, &found);
+    if(found) {
+        old = entries[i];
+        if(source != NULL) {
+            entries[i] = source;
+        } else {
+            memmove(&entries[i], &entries[i + 1], (n_entries - i - 1) * sizeof *entries);
+            n_entries--;
+        }
+    } else if(source != NULL) {
+        if(n_entries == entries_size) {
+            entries_size = entries_size ? entries_size * 2 : 64;
+            entries = realloc(entries, entries_size * sizeof *entries);
+            if(entries == NULL) MEMFAIL();
+        }
+        memmove(&entries[i + 1], &entries[i], (n_entries - i) * sizeof *entries);
+        entries[i] = source;
+        n_entries++;
+    }
+    SDL_AtomicUnlock(&index_lock);
+
+    pattern_source_free(old);
+}
+
+static void index_clear() {
+    SDL_AtomicLock(&index_lock);
+    struct pattern_source ** old = entries;
+    int n_old = n_entries;
+    entries = NULL;
+    n_entries = 0;
+    entries_size = 0;
+    SDL_AtomicUnlock(&index_lock);
+
+    for(int i = 0; i < n_old; i++) {
+        pattern_source_free(old[i]);
+    }
+    free(old);
+}
+
+static void index_scan() {
+    DIR * dir = opendir(config.pattern.dir);
+    if(dir == NULL) {
+        ERROR("Could not open pattern directory '%s': %s", config.pattern.dir, strerror(errno));
+        return;
+    }
+
+    struct dirent * d;
+    while((d = readdir(dir)) != NULL) {
+        int pass;
+        char * name = parse_filename(d->d_name, &pass);
+        if(name == NULL) continue;
+        if(pass == 0) index_set(name, source_read(name));
+        free(name);
+    }
+    closedir(dir);
+    INFO("Indexed %d patterns in '%s'", n_entries, config.pattern.dir);
+}
+
+void pattern_index_init() {
+#ifdef __LINUX__
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotify_fd < 0) {
+        PERROR("Could not initialize inotify");
+    } else if((pattern_wd = inotify_add_watch(inotify_fd, config.pattern.dir,
+                                IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)) < 0) {
+        PERROR("Could not watch pattern directory '%s'", config.pattern.dir);
+        close(inotify_fd);
+        inotify_fd = -1;
+    } else if((header_wd = inotify_add_watch(inotify_fd, HEADER_DIR, IN_CLOSE_WRITE | IN_MOVED_TO)) < 0) {
+        PERROR("Could not watch '%s'", HEADER_DIR);
+    }
+#endif
+    index_scan();
+}
+
+void pattern_index_term() {
+#ifdef __LINUX__
+    if(inotify_fd >= 0) close(inotify_fd);
+    inotify_fd = -1;
+    pattern_wd = -1;
+    header_wd = -1;
+#endif
+    index_clear();
+}
+
+void pattern_index_refresh(void (*changed)(const char * name)) {
+#ifdef __LINUX__
+    if(inotify_fd < 0) return;
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for(;;) {
+        ssize_t length = read(inotify_fd, buffer, sizeof buffer);
+        if(length <= 0) {
+            if(length < 0 && errno != EAGAIN && errno != EINTR) PERROR("Could not read inotify events");
+            return;
+        }
+
+        for(char * ptr = buffer; ptr < buffer + length; ) {
+            const struct inotify_event * event = (const struct inotify_event *) ptr;
+            ptr += sizeof *event + event->len;
+
+            if(event->mask & IN_Q_OVERFLOW) {
+                index_clear();
+                index_scan();
+                if(changed != NULL) changed(NULL);
+                continue;
+            }
+            if(event->len == 0) continue;
+
+            if(event->wd == header_wd) {
+                if(strcmp(event->name, HEADER_NAME) != 0) continue;
+                INFO("Shader header changed on disk");
+                if(changed != NULL) changed(NULL);
+                continue;
+            }
+
+            int pass;
+            char * name = parse_filename(event->name, &pass);
+            if(name == NULL) continue;
+            INFO("Pattern '%s' changed on disk", name);
+            index_set(name, source_read(name));
+            if(changed != NULL) changed(name);
+            free(name);
+        }
+    }
+#endif
+}
+
+struct pattern_source * pattern_index_get(const char * name) {
+#ifdef __LINUX__
+    bool watched = inotify_fd >= 0;
+#else
+    bool watched = false;
+#endif
+    if(!watched) {
+        // Without change notifications, the disk is the only source of truth
+        struct pattern_source * source = source_read(name);
+        index_set(name, source != NULL ? source_copy(source) : NULL);
+        return source;
+    }
+
+    struct pattern_source * source = NULL;
+    SDL_AtomicLock(&index_lock);
+    bool found;
+    int i = index_find(name, &found);
+    if(found) source = source_copy(entries[i]);
+    SDL_AtomicUnlock(&index_lock);
+    return source;
+}
+
+int pattern_index_complete(char * prefix, size_t size) {
+    size_t prefix_len = strlen(prefix);
+    const char * first = NULL;
+    size_t common = 0;
+    int n = 0;
+
+    SDL_AtomicLock(&index_lock);
+    for(int i = 0; i < n_entries; i++) {
+        const char * name = entries[i]->name;
+        if(strncmp(name, prefix, prefix_len) != 0) continue;
+        if(n++ == 0) {
+            first = name;
+            common = strlen(name);
+        } else {
+            size_t j = prefix_len;
+            while(j < common && name[j] == first[j]) j++;
+            common = j;
+        }
+    }
+    if(n > 0 && common < size) {
+        memcpy(prefix, first, common);
+        prefix[common] = '\0';
+    }
+    SDL_AtomicUnlock(&index_lock);
+    return n;
+}
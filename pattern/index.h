@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h> // Not time.h: main.h declares a global `time`
+
+// In-memory index of the patterns in `[pattern] dir`.
+//
+// The directory is scanned once at startup and then kept up to date with inotify
+// (on Linux; elsewhere a pattern is re-read from disk each time it is looked up),
+// so loading a pattern doesn't touch the filesystem.
+
+struct pattern_source {
+    char * name;
+    int n_passes;
+    char ** source;     // source[i] is the contents of NAME.i.glsl
+    time_t * mtime;
+};
+
+void pattern_index_init();
+void pattern_index_term();
+
+// Apply pending filesystem changes, calling `changed` with the name of each pattern
+// that changed (NULL if they all may have, e.g. when the shader header changes).
+// Call once a frame from the render thread.
+void pattern_index_refresh(void (*changed)(const char * name));
+
+// Copy of the sources of pattern `name`, or NULL if there is no such pattern.
+// Safe to call from the pattern loader thread; free with pattern_source_free.
+struct pattern_source * pattern_index_get(const char * name);
+void pattern_source_free(struct pattern_source * source);
+
+// Extend `prefix` (in place, up to `size` bytes) as far as all the pattern names starting
+// with it agree. Returns the number of matching patterns.
+int pattern_index_complete(char * prefix, size_t size);
@@ -0,0 +1,164 @@
+#include "pattern/loader.h"
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_thread.h>
+#include <stdlib.h>
+
+#include "pattern/soft.h"
+#include "ui/ui.h"
+#include "util/err.h"
+#include "util/ring.h"
+
+#define LOADER_QUEUE_SIZE 32
+
+static SDL_Thread * loader_thread = NULL;
+static void * loader_context = NULL;
+static SDL_sem * loader_wake = NULL;
+static volatile bool loader_active = false;
+
+// Batches waiting to be loaded, and loaded batches waiting to be swapped in.
+// At most LOADER_QUEUE_SIZE batches are in flight, so neither ring can overflow.
+static struct ring requests;
+static struct ring results;
+static unsigned int n_in_flight = 0;
+
+static int loader_run(void * args) {
+    SDL_sem * started = args;
+    int rc = ui_shared_context_bind(loader_context);
+    loader_active = rc == 0;
+    SDL_SemPost(started);
+    if(rc < 0) return -1;
+
+    for(;;) {
+        SDL_SemWait(loader_wake);
+        if(!loader_active) break;
+
+        struct loader_item * batch = ring_pop(&requests);
+        if(batch == NULL) continue;
+
+        for(struct loader_item * item = batch; item != NULL; item = item->next) {
+            if(item->prefix == NULL) continue;
+            struct pattern * p = calloc(1, sizeof *p);
+            if(p == NULL) MEMFAIL();
+            if(pattern_init(p, item->prefix) != 0) {
+                WARN("Error loading pattern '%s'", item->prefix);
+                pattern_term(p);
+                free(p);
+                p = NULL;
+            }
+            item->pattern = p;
+        }
+
+        // Make sure everything is done before the render thread uses it
+        glFinish();
+        ring_push(&results, batch);
+    }
+
+    ui_shared_context_bind(NULL);
+    return 0;
+}
+
+void loader_start() {
+    // Software patterns don't need compiling
+    if(soft_enabled) return;
+
+    loader_context = ui_shared_context_create();
+    if(loader_context == NULL) {
+        WARN("Loading patterns synchronously");
+        return;
+    }
+
+    ring_init(&requests, LOADER_QUEUE_SIZE);
+    ring_init(&results, LOADER_QUEUE_SIZE);
+    n_in_flight = 0;
+    loader_wake = SDL_CreateSemaphore(0);
+    SDL_sem * started = SDL_CreateSemaphore(0);
+    if(loader_wake == NULL || started == NULL) FAIL("Could not create loader semaphore: %s", SDL_GetError());
+
+    loader_thread = SDL_CreateThread(&loader_run, "Loader", started);
+    if(!loader_thread) FAIL("Could not create loader thread: %s", SDL_GetError());
+    SDL_SemWait(started);
+    SDL_DestroySemaphore(started);
+
+    if(!loader_active) {
+        WARN("Could not bind loader OpenGL context; loading patterns synchronously");
+        SDL_WaitThread(loader_thread, NULL);
+        loader_thread = NULL;
+        loader_stop();
+    }
+}
+
+void loader_stop() {
+    if(loader_thread != NULL) {
+        loader_active = false;
+        SDL_SemPost(loader_wake);
+        SDL_WaitThread(loader_thread, NULL);
+        loader_thread = NULL;
+    }
+
+    if(loader_wake != NULL) {
+        struct loader_item * batch;
+        while((batch = ring_pop(&requests)) != NULL) loader_free(batch);
+        while((batch = ring_pop(&results)) != NULL) loader_free(batch);
+        ring_term(&requests);
+        ring_term(&results);
+        SDL_DestroySemaphore(loader_wake);
+        loader_wake = NULL;
+    }
+
+    ui_shared_context_destroy(loader_context);
+    loader_context = NULL;
+    loader_active = false;
+}
+
+bool loader_running() {
+    return loader_thread != NULL;
+}
+
+int loader_queue(struct loader_item * batch) {
+    if(!loader_running() || n_in_flight >= LOADER_QUEUE_SIZE) {
+        loader_free(batch);
+        return -1;
+    }
+    // Only an accepted batch supersedes the loads already in flight for its slots
+    for(struct loader_item * item = batch; item != NULL; item = item->next)
+        item->generation = ++item->deck->generation[item->slot];
+    ring_push(&requests, batch);
+    n_in_flight++;
+    SDL_SemPost(loader_wake);
+    return 0;
+}
+
+void loader_swap(void (*swapped)(struct deck * deck, int slot)) {
+    if(!loader_running()) return;
+
+    struct loader_item * batch;
+    while((batch = ring_pop(&results)) != NULL) {
+        n_in_flight--;
+        for(struct loader_item * item = batch; item != NULL; item = item->next) {
+            if(item->generation != item->deck->generation[item->slot]) continue;
+            if(item->prefix != NULL && item->pattern == NULL) continue;
+
+            struct pattern * old = item->deck->pattern[item->slot];
+            if(item->keep_state && old != NULL && item->pattern != NULL)
+                pattern_adopt_state(item->pattern, old);
+            deck_replace_pattern(item->deck, item->slot, item->pattern, item->intensity);
+            item->pattern = NULL;
+            if(swapped != NULL) swapped(item->deck, item->slot);
+        }
+        loader_free(batch);
+    }
+}
+
+void loader_free(struct loader_item * batch) {
+    while(batch != NULL) {
+        struct loader_item * next = batch->next;
+        if(batch->pattern != NULL) {
+            pattern_term(batch->pattern);
+            free(batch->pattern);
+        }
+        free(batch->prefix);
+        free(batch);
+        batch = next;
+    }
+}
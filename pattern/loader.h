@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include "pattern/deck.h"
+
+// Background pattern loading.
+//
+// Patterns are compiled and their textures allocated on a separate thread with
+// its own (shared) OpenGL context. Finished batches are swapped into their
+// decks between frames by `loader_swap`, so loading never stalls rendering.
+
+struct loader_item {
+    struct loader_item * next;  // Items in the same batch are swapped in together
+    struct deck * deck;
+    int slot;
+    char * prefix;              // NULL to unload the slot
+    float intensity;            // < 0 to keep the intensity of the pattern being replaced
+    bool keep_state;            // Take over the replaced pattern's textures (see pattern_adopt_state)
+    unsigned int generation;    // Set by loader_queue; stale if the slot has been changed since
+    struct pattern * pattern;   // Filled in by the loader; NULL if loading failed
+};
+
+// Must be called from the render thread
+void loader_start();
+void loader_stop();
+bool loader_running();
+
+// Takes ownership of `batch`. Returns -1 if the queue is full, leaving the decks untouched.
+int loader_queue(struct loader_item * batch);
+// Swap finished batches into their decks, calling `swapped` for each changed slot
+void loader_swap(void (*swapped)(struct deck * deck, int slot));
+void loader_free(struct loader_item * batch);
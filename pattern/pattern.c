@@ -1,9 +1,13 @@
 #include "pattern/pattern.h"
+#include "pattern/texpool.h"
+#include "pattern/index.h"
+#include "pattern/soft.h"
 #include "time/timebase.h"
 #include "util/glsl.h"
 #include "util/string.h"
 #include "util/err.h"
 #include "util/config.h"
+#include "util/profile.h"
 #include "main.h"
 
 #include <assert.h>
@@ -13,10 +17,52 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
-#include <sys/stat.h>
 #include <unistd.h>
 #include <math.h>
 
+static GLuint globals_buffer = 0;
+
+void pattern_globals_init() {
+    GLenum e;
+
+    if(soft_enabled) return;
+
+    const char * extensions = (const char *) glGetString(GL_EXTENSIONS);
+    if(extensions == NULL || strstr(extensions, "GL_ARB_uniform_buffer_object") == NULL) {
+        INFO("Uniform buffers not supported; setting pattern globals per pass");
+        return;
+    }
+
+    glGenBuffers(1, &globals_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, globals_buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(struct pattern_globals), NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, PATTERN_GLOBALS_BINDING, globals_buffer);
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+}
+
+void pattern_globals_update() {
+    if(globals_buffer == 0) return;
+
+    struct pattern_globals globals = {
+        .time = time_master.beat_frac + time_master.beat_index,
+        .audio_hi = audio_hi,
+        .audio_mid = audio_mid,
+        .audio_low = audio_low,
+        .audio_level = audio_level,
+        .fps = config.ui.fps,
+    };
+    glBindBuffer(GL_UNIFORM_BUFFER, globals_buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof globals, &globals);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void pattern_globals_term() {
+    if(globals_buffer == 0) return;
+    glDeleteBuffers(1, &globals_buffer);
+    globals_buffer = 0;
+}
+
 int pattern_init(struct pattern * pattern, const char * prefix) {
     GLenum e;
 
@@ -27,32 +73,28 @@ int pattern_init(struct pattern * pattern, const char * prefix) {
     pattern->name = strdup(prefix);
     if(pattern->name == NULL) ERROR("Could not allocate memory");
 
-    int n = 0;
-    for(;;) {
-        char * filename;
-        struct stat statbuf;
-        filename = rsprintf("%s%s.%d.glsl", config.pattern.dir, prefix, n);
-        if(filename == NULL) MEMFAIL();
-
-        int rc = stat(filename, &statbuf);
-        free(filename);
-
-        if (rc != 0 || S_ISDIR(statbuf.st_mode)) {
-            break;
-        }
-        n++;
-    }
+    if(soft_enabled) return soft_pattern_init(pattern, prefix);
 
-    if(n == 0) {
+    struct pattern_source * source = pattern_index_get(prefix);
+    if(source == NULL) {
         ERROR("Could not find any shaders for %s", prefix);
         return 1;
     }
-    pattern->n_shaders = n;
+    if(source->n_passes <= 0) {
+        ERROR("Pattern %s has no shaders", prefix);
+        pattern_source_free(source);
+        return 1;
+    }
+    pattern->n_shaders = source->n_passes;
 
     pattern->shader = calloc(pattern->n_shaders, sizeof *pattern->shader);
     if(pattern->shader == NULL) MEMFAIL();
-    pattern->tex = calloc(pattern->n_shaders, sizeof *pattern->tex);
+    pattern->uni = calloc(pattern->n_shaders, sizeof *pattern->uni);
+    if(pattern->uni == NULL) MEMFAIL();
+    pattern->tex = calloc(pattern->n_shaders + 1, sizeof *pattern->tex);
     if(pattern->tex == NULL) MEMFAIL();
+    pattern->uni_tex = calloc(pattern->n_shaders, sizeof *pattern->uni_tex);
+    if(pattern->uni_tex == NULL) MEMFAIL();
 
     bool success = true;
     for(int i = 0; i < pattern->n_shaders; i++) {
@@ -60,7 +102,7 @@ int pattern_init(struct pattern * pattern, const char * prefix) {
         filename = rsprintf("%s%s.%d.glsl", config.pattern.dir, prefix, i);
         if(filename == NULL) MEMFAIL();
 
-        GLhandleARB h = load_shader(filename);
+        GLhandleARB h = load_shader_source(source->source[i], filename);
 
         if (h == 0) {
             fprintf(stderr, "%s", load_shader_error);
@@ -72,6 +114,7 @@ int pattern_init(struct pattern * pattern, const char * prefix) {
         }
         free(filename);
     }
+    pattern_source_free(source);
     if(!success) {
         ERROR("Failed to load some shaders.");
         return 2;
@@ -79,66 +122,99 @@ int pattern_init(struct pattern * pattern, const char * prefix) {
 
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
-    // Render targets
-    glGenFramebuffersEXT(1, &pattern->fb);
-    glGenTextures(pattern->n_shaders + 1, pattern->tex);
-
-    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
-
-    for(int i = 0; i < pattern->n_shaders + 1; i++) {
-        glBindTexture(GL_TEXTURE_2D, pattern->tex[i]);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, config.pattern.master_width, config.pattern.master_height, 0, 
-                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    }
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
-
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, pattern->fb);
+    // Render targets come from the pool, and are cleared on first render: framebuffers
+    // aren't shared between contexts, and patterns may be loaded on another thread
+    // Decks may resize them later; see pattern_resize
+    pattern->width = config.pattern.master_width;
+    pattern->height = config.pattern.master_height;
     for(int i = 0; i < pattern->n_shaders + 1; i++) {
-        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D,
-                                  pattern->tex[i], 0);
-        glClear(GL_COLOR_BUFFER_BIT);
+        pattern->tex[i] = texpool_get(pattern->width, pattern->height);
     }
 
-    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
-
     // Some OpenGL API garbage
-    pattern->uni_tex = calloc(pattern->n_shaders, sizeof *pattern->uni_tex);
-    if(pattern->uni_tex == NULL) MEMFAIL();
     for(int i = 0; i < pattern->n_shaders; i++) {
         pattern->uni_tex[i] = i + 1;
     }
 
+    // Look up uniforms once, and set the ones that never change
+    for(int i = 0; i < pattern->n_shaders; i++) {
+        GLhandleARB h = pattern->shader[i];
+        struct pattern_uniforms * u = &pattern->uni[i];
+        if(globals_buffer != 0) {
+            GLuint block = glGetUniformBlockIndex((GLuint) h, "Globals");
+            if(block != GL_INVALID_INDEX)
+                glUniformBlockBinding((GLuint) h, block, PATTERN_GLOBALS_BINDING);
+        }
+        // These are -1 when they live in the Globals block
+        u->time = glGetUniformLocationARB(h, "iTime");
+        u->audio_hi = glGetUniformLocationARB(h, "iAudioHi");
+        u->audio_mid = glGetUniformLocationARB(h, "iAudioMid");
+        u->audio_low = glGetUniformLocationARB(h, "iAudioLow");
+        u->audio_level = glGetUniformLocationARB(h, "iAudioLevel");
+        u->intensity = glGetUniformLocationARB(h, "iIntensity");
+        u->intensity_integral = glGetUniformLocationARB(h, "iIntensityIntegral");
+        // Programs are shared between patterns, which may render at different resolutions
+        u->resolution = glGetUniformLocationARB(h, "iResolution");
+
+        GLint loc;
+        glUseProgramObjectARB(h);
+        if((loc = glGetUniformLocationARB(h, "iFPS")) >= 0)
+            glUniform1fARB(loc, config.ui.fps);
+        if((loc = glGetUniformLocationARB(h, "iFrame")) >= 0)
+            glUniform1iARB(loc, 0);
+        if((loc = glGetUniformLocationARB(h, "iChannel")) >= 0) {
+            glUniform1ivARB(loc, pattern->n_shaders, pattern->uni_tex);
+            pattern->stateful = true;
+        }
+    }
+    glUseProgramObjectARB(0);
+    // Shader 0 is rendered last and produces the output
+    pattern->fades = pattern->uni[0].intensity >= 0;
+
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+
     return 0;
 }
 
 void pattern_term(struct pattern * pattern) {
     GLenum e;
 
-    for (int i = 0; i < pattern->n_shaders; i++) {
-        glDeleteObjectARB(pattern->shader[i]);
-    }
+    if(pattern->soft != NULL) {
+        soft_pattern_term(pattern);
+    } else if(pattern->shader != NULL) {
+        // Also called on patterns that failed to load, so some passes may be missing
+        for (int i = 0; i < pattern->n_shaders; i++) {
+            if(pattern->shader[i] != 0) unload_shader(pattern->shader[i]);
+        }
 
-    glDeleteTextures(pattern->n_shaders + 1, pattern->tex);
-    glDeleteFramebuffersEXT(1, &pattern->fb);
+        if(pattern->tex != NULL) {
+            for(int i = 0; i < pattern->n_shaders + 1; i++) {
+                texpool_put(pattern->tex[i]);
+            }
+        }
 
-    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+        if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+    }
 
     free(pattern->name);
+    free(pattern->shader);
+    free(pattern->uni);
+    free(pattern->tex);
+    free(pattern->uni_tex);
     memset(pattern, 0, sizeof *pattern);
 }
 
-void pattern_render(struct pattern * pattern, GLuint input_tex) {
+void pattern_render(struct pattern * pattern, GLuint input_tex, bool sparse) {
     GLenum e;
 
+    if(!pattern->cleared) {
+        texpool_clear(pattern->tex, pattern->n_shaders + 1);
+        pattern->cleared = true;
+    }
+
     glLoadIdentity();
-    glViewport(0, 0, config.pattern.master_width, config.pattern.master_height);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, pattern->fb);
+    glViewport(0, 0, pattern->width, pattern->height);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, texpool_framebuffer());
 
     pattern->intensity_integral = fmod(pattern->intensity_integral + pattern->intensity / config.ui.fps, MAX_INTEGRAL);
 
@@ -156,42 +232,26 @@ void pattern_render(struct pattern * pattern, GLuint input_tex) {
 
         if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
-        GLint loc;
-        loc = glGetUniformLocationARB(pattern->shader[i], "iTime");
-        glUniform1fARB(loc, time_master.beat_frac + time_master.beat_index);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iAudioHi");
-        glUniform1fARB(loc, audio_hi);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iAudioMid");
-        glUniform1fARB(loc, audio_mid);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iAudioLow");
-        glUniform1fARB(loc, audio_low);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iAudioLevel");
-        glUniform1fARB(loc, audio_level);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iResolution");
-        glUniform2fARB(loc, config.pattern.master_width, config.pattern.master_height);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iIntensity");
-        glUniform1fARB(loc, pattern->intensity);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iIntensityIntegral");
-        glUniform1fARB(loc, pattern->intensity_integral);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iFPS");
-        glUniform1fARB(loc, config.ui.fps);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iFrame");
-        glUniform1iARB(loc, 0);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iChannel");
-        glUniform1ivARB(loc, pattern->n_shaders, pattern->uni_tex);
+        const struct pattern_uniforms * u = &pattern->uni[i];
+        if(u->resolution >= 0) glUniform2fARB(u->resolution, pattern->width, pattern->height);
+        if(u->time >= 0) glUniform1fARB(u->time, time_master.beat_frac + time_master.beat_index);
+        if(u->audio_hi >= 0) glUniform1fARB(u->audio_hi, audio_hi);
+        if(u->audio_mid >= 0) glUniform1fARB(u->audio_mid, audio_mid);
+        if(u->audio_low >= 0) glUniform1fARB(u->audio_low, audio_low);
+        if(u->audio_level >= 0) glUniform1fARB(u->audio_level, audio_level);
+        if(u->intensity >= 0) glUniform1fARB(u->intensity, pattern->intensity);
+        if(u->intensity_integral >= 0) glUniform1fARB(u->intensity_integral, pattern->intensity_integral);
 
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, input_tex);
 
         if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
+        int span = profile_gpu_begin();
         glClear(GL_COLOR_BUFFER_BIT);
-        glBegin(GL_QUADS);
-        glVertex2d(-1, -1);
-        glVertex2d(-1, 1);
-        glVertex2d(1, 1);
-        glVertex2d(1, -1);
-        glEnd();
+        // Shader 0 produces the output; the others are state, and are always rendered in full
+        render_draw(&render, sparse && i == 0);
+        profile_gpu_end(span, "%s.%d", pattern->name, i);
 
         if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
     }
@@ -201,3 +261,52 @@ void pattern_render(struct pattern * pattern, GLuint input_tex) {
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
     pattern->tex_output = pattern->tex[pattern->flip];
 }
+
+int pattern_adopt_state(struct pattern * pattern, struct pattern * old) {
+    if(pattern->n_shaders != old->n_shaders) return -1;
+
+    GLuint * tex = pattern->tex;
+    pattern->tex = old->tex;
+    old->tex = tex;
+
+    struct soft_frame ** frames = pattern->frames;
+    pattern->frames = old->frames;
+    old->frames = frames;
+    pattern->frame_output = old->frame_output;
+    old->frame_output = NULL;
+
+    bool cleared = pattern->cleared;
+    pattern->cleared = old->cleared;
+    old->cleared = cleared;
+
+    int width = pattern->width, height = pattern->height;
+    pattern->width = old->width;
+    pattern->height = old->height;
+    old->width = width;
+    old->height = height;
+
+    pattern->flip = old->flip;
+    pattern->tex_output = old->tex_output;
+    pattern->intensity_integral = old->intensity_integral;
+    old->flip = 0;
+    old->tex_output = 0;
+    return 0;
+}
+
+void pattern_resize(struct pattern * pattern, int width, int height) {
+    if(pattern->width == width && pattern->height == height) return;
+    // The software renderer always renders at master size
+    if(pattern->soft != NULL) return;
+
+    for(int i = 0; i < pattern->n_shaders + 1; i++) {
+        GLuint tex = texpool_get(width, height);
+        // Carry feedback state over, rescaled
+        if(pattern->cleared)
+            texpool_copy(pattern->tex[i], pattern->width, pattern->height, tex, width, height);
+        texpool_put(pattern->tex[i]);
+        pattern->tex[i] = tex;
+    }
+    pattern->width = width;
+    pattern->height = height;
+    pattern->tex_output = pattern->cleared ? pattern->tex[pattern->flip] : 0;
+}
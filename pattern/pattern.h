@@ -7,20 +7,74 @@
 
 #define MAX_INTEGRAL 1024
 
+// Contents of the `Globals` uniform block in resources/header.glsl (std140 layout)
+struct pattern_globals {
+    GLfloat time;
+    GLfloat audio_hi;
+    GLfloat audio_mid;
+    GLfloat audio_low;
+    GLfloat audio_level;
+    GLfloat fps;
+    GLfloat padding[2];
+};
+
+#define PATTERN_GLOBALS_BINDING 0
+
+// Uniform locations of one pattern shader; -1 if the shader doesn't use it,
+// or if it is part of the `Globals` block
+struct pattern_uniforms {
+    GLint time;
+    GLint audio_hi;
+    GLint audio_mid;
+    GLint audio_low;
+    GLint audio_level;
+    GLint intensity;
+    GLint intensity_integral;
+    GLint resolution;
+};
+
 struct pattern {
     GLhandleARB * shader;
+    struct pattern_uniforms * uni;
     int n_shaders;
     char * name;
     double intensity;
     double intensity_integral;
 
+    bool stateful;  // Reads its channels, so it has to be rendered every frame
+    bool fades;     // Reads iIntensity, so it is a pass-through at intensity 0
+
     int flip;
-    GLuint * tex;
-    GLuint fb;
+    GLuint * tex;   // From the texture pool
+    int width;      // Size of tex; less than master size if the deck is rendering at reduced resolution
+    int height;
+    bool cleared;
     GLint * uni_tex;
     GLuint tex_output;
+
+    // Software renderer (see pattern/soft.h); NULL when rendering with OpenGL
+    const struct soft_kernel * soft;
+    struct soft_frame ** frames;
+    const struct soft_frame * frame_output;
 };
 
+// Per-frame values shared by all patterns. If uniform buffers aren't supported,
+// pattern_render falls back to setting them on every pass.
+void pattern_globals_init();
+void pattern_globals_update();
+void pattern_globals_term();
+
 int pattern_init(struct pattern * pattern, const char * prefix);
 void pattern_term(struct pattern * pattern);
-void pattern_render(struct pattern * pattern, GLuint input_tex);
+// With `sparse`, only the part of the output that output devices sample is rendered
+void pattern_render(struct pattern * pattern, GLuint input_tex, bool sparse);
+// Swap render targets with `old`, a previous build of the same pattern, so that the
+// new one carries on from its state. Fails if the number of passes changed.
+int pattern_adopt_state(struct pattern * pattern, struct pattern * old);
+// Render at a different resolution from now on, rescaling the pattern's state
+void pattern_resize(struct pattern * pattern, int width, int height);
+
+// Whether rendering can be skipped this frame, passing the input straight through
+static inline bool pattern_bypassed(const struct pattern * pattern) {
+    return pattern->intensity == 0 && pattern->fades && !pattern->stateful;
+}
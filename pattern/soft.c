@@ -0,0 +1,224 @@
+#include "pattern/soft.h"
+#include "pattern/pattern.h"
+#include "time/timebase.h"
+#include "util/config.h"
+#include "util/err.h"
+#include "util/profile.h"
+#include "util/tiles.h"
+#include "main.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool soft_enabled = false;
+
+// Rows are split into tiles this big, so a pass fits in cache and balances across workers
+#define SOFT_TILE_SIZE 32
+
+void soft_init() {
+    soft_enabled = strcmp(config.pattern.renderer, "cpu") == 0;
+    if(!soft_enabled) {
+        if(strcmp(config.pattern.renderer, "gl") != 0)
+            WARN("Unknown renderer '%s'; using OpenGL", config.pattern.renderer);
+        return;
+    }
+    tiles_start(config.pattern.threads);
+}
+
+void soft_term() {
+    if(soft_enabled) tiles_stop();
+    soft_enabled = false;
+}
+
+struct soft_frame * soft_frame_new(int width, int height) {
+    struct soft_frame * frame = calloc(1, sizeof *frame);
+    if(frame == NULL) MEMFAIL();
+    frame->width = width;
+    frame->height = height;
+
+    void * pixels;
+    if(posix_memalign(&pixels, sizeof(v4f), (size_t) width * height * sizeof(v4f)) != 0) MEMFAIL();
+    memset(pixels, 0, (size_t) width * height * sizeof(v4f));
+    frame->pixels = pixels;
+    return frame;
+}
+
+void soft_frame_free(struct soft_frame * frame) {
+    if(frame == NULL) return;
+    free(frame->pixels);
+    free(frame);
+}
+
+v4f soft_texture(const struct soft_frame * frame, float u, float v) {
+    // Texel centers are at half-integers
+    float x = soft_clamp(u * frame->width - 0.5, 0., frame->width - 1);
+    float y = soft_clamp(v * frame->height - 0.5, 0., frame->height - 1);
+    int x0 = x, y0 = y;
+    int x1 = x0 + 1 < frame->width ? x0 + 1 : x0;
+    int y1 = y0 + 1 < frame->height ? y0 + 1 : y0;
+    float fx = x - x0, fy = y - y0;
+
+    const v4f * row0 = &frame->pixels[y0 * frame->width];
+    const v4f * row1 = &frame->pixels[y1 * frame->width];
+    v4f bottom = v4f_mix(row0[x0], row0[x1], fx);
+    v4f top = v4f_mix(row1[x0], row1[x1], fx);
+    return v4f_mix(bottom, top, fy);
+}
+
+int soft_pattern_init(struct pattern * pattern, const char * name) {
+    const struct soft_kernel * kernel = NULL;
+    for(const struct soft_kernel * k = soft_kernels; k->name != NULL; k++) {
+        if(strcmp(k->name, name) == 0) {
+            kernel = k;
+            break;
+        }
+    }
+    if(kernel == NULL) {
+        ERROR("Pattern '%s' has no software version", name);
+        return 1;
+    }
+
+    pattern->soft = kernel;
+    pattern->n_shaders = kernel->n_passes;
+    pattern->stateful = kernel->stateful;
+    pattern->fades = kernel->fades;
+    pattern->width = config.pattern.master_width;
+    pattern->height = config.pattern.master_height;
+
+    pattern->frames = calloc(pattern->n_shaders + 1, sizeof *pattern->frames);
+    if(pattern->frames == NULL) MEMFAIL();
+    for(int i = 0; i < pattern->n_shaders + 1; i++) {
+        pattern->frames[i] = soft_frame_new(pattern->width, pattern->height);
+    }
+    return 0;
+}
+
+void soft_pattern_term(struct pattern * pattern) {
+    if(pattern->frames != NULL) {
+        for(int i = 0; i < pattern->n_shaders + 1; i++) {
+            soft_frame_free(pattern->frames[i]);
+        }
+    }
+    free(pattern->frames);
+    pattern->frames = NULL;
+    pattern->frame_output = NULL;
+}
+
+struct soft_job {
+    const struct soft_uniforms * uniforms;
+    soft_pass pass;
+    struct soft_frame * target;
+    int tiles_w;
+};
+
+static void soft_job_tile(void * arg, int tile) {
+    const struct soft_job * job = arg;
+    struct soft_frame * target = job->target;
+    int x0 = (tile % job->tiles_w) * SOFT_TILE_SIZE;
+    int y0 = (tile / job->tiles_w) * SOFT_TILE_SIZE;
+    int x1 = x0 + SOFT_TILE_SIZE < target->width ? x0 + SOFT_TILE_SIZE : target->width;
+    int y1 = y0 + SOFT_TILE_SIZE < target->height ? y0 + SOFT_TILE_SIZE : target->height;
+
+    for(int y = y0; y < y1; y++) {
+        job->pass(job->uniforms, y, x0, x1, &target->pixels[y * target->width + x0]);
+    }
+}
+
+void soft_pattern_render(struct pattern * pattern, const struct soft_frame * input) {
+    pattern->intensity_integral = fmod(pattern->intensity_integral + pattern->intensity / config.ui.fps, MAX_INTEGRAL);
+
+    struct soft_uniforms u = {
+        .time = time_master.beat_frac + time_master.beat_index,
+        .audio_hi = audio_hi,
+        .audio_mid = audio_mid,
+        .audio_low = audio_low,
+        .audio_level = audio_level,
+        .fps = config.ui.fps,
+        .intensity = pattern->intensity,
+        .intensity_integral = pattern->intensity_integral,
+        .resolution = {pattern->width, pattern->height},
+        .frame = input,
+    };
+
+    int n = pattern->n_shaders;
+    int tiles_w = (pattern->width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    int tiles_h = (pattern->height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+
+    // Same arrangement of passes and channels as pattern_render
+    for(int i = n - 1; i >= 0; i--) {
+        for(int j = 0; j < n; j++) {
+            u.channel[j] = pattern->frames[(pattern->flip + j + (i < j)) % (n + 1)];
+        }
+        struct soft_job job = {
+            .uniforms = &u,
+            .pass = pattern->soft->pass[i],
+            .target = pattern->frames[(pattern->flip + i + 1) % (n + 1)],
+            .tiles_w = tiles_w,
+        };
+        uint64_t start = profile_now();
+        tiles_run(tiles_w * tiles_h, &soft_job_tile, &job);
+        profile_cpu(start, "%s.%d", pattern->name, i);
+    }
+    pattern->flip = (pattern->flip + 1) % (n + 1);
+    pattern->frame_output = pattern->frames[pattern->flip];
+}
+
+struct soft_crossfade_job {
+    uint8_t * rgba;
+    int width;
+    int height;
+    int tiles_w;
+    const struct soft_frame * bottom;
+    const struct soft_frame * top;
+    v4f bottom_alpha;
+    v4f top_alpha;
+};
+
+// Frames at the output size are read texel-for-texel; others are filtered like the GL path
+static inline v4f soft_crossfade_fetch(const struct soft_crossfade_job * job, const struct soft_frame * frame,
+                                       int x, int y) {
+    if(frame->width == job->width && frame->height == job->height)
+        return frame->pixels[y * frame->width + x];
+    return soft_texture(frame, (x + 0.5f) / job->width, (y + 0.5f) / job->height);
+}
+
+static void soft_crossfade_tile(void * arg, int tile) {
+    const struct soft_crossfade_job * job = arg;
+    int x0 = (tile % job->tiles_w) * SOFT_TILE_SIZE;
+    int y0 = (tile / job->tiles_w) * SOFT_TILE_SIZE;
+    int x1 = x0 + SOFT_TILE_SIZE < job->width ? x0 + SOFT_TILE_SIZE : job->width;
+    int y1 = y0 + SOFT_TILE_SIZE < job->height ? y0 + SOFT_TILE_SIZE : job->height;
+
+    for(int y = y0; y < y1; y++) {
+        uint8_t * out = &job->rgba[4 * ((size_t) y * job->width + x0)];
+        for(int x = x0; x < x1; x++) {
+            v4f b = soft_crossfade_fetch(job, job->bottom, x, y) * job->bottom_alpha;
+            v4f t = soft_crossfade_fetch(job, job->top, x, y) * job->top_alpha;
+            v4f c = soft_composite(b, t) * 255.f + 0.5f;
+            for(int k = 0; k < 4; k++) {
+                *out++ = c[k];
+            }
+        }
+    }
+}
+
+// Same as resources/crossfader.glsl, followed by the conversion glReadPixels does
+void soft_crossfade(uint8_t * rgba, int width, int height, const struct soft_frame * left,
+                    const struct soft_frame * right, float position, bool left_on_top) {
+    v4f left_alpha = {1., 1., 1., fminf((1. - position) * 2., 1.)};
+    v4f right_alpha = {1., 1., 1., fminf(position * 2., 1.)};
+
+    int tiles_w = (width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    int tiles_h = (height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    struct soft_crossfade_job job = {
+        .rgba = rgba,
+        .width = width,
+        .height = height,
+        .tiles_w = tiles_w,
+        .bottom = left_on_top ? right : left,
+        .top = left_on_top ? left : right,
+        .bottom_alpha = left_on_top ? right_alpha : left_alpha,
+        .top_alpha = left_on_top ? left_alpha : right_alpha,
+    };
+    tiles_run(tiles_w * tiles_h, &soft_crossfade_tile, &job);
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Software renderer, for machines without a GPU (`[pattern] renderer = cpu`, headless only).
+//
+// Patterns are C ports of their GLSL versions (see pattern/soft_patterns.c). Each pass
+// shades a frame row by row, spread over the tile workers in util/tiles.h, with the
+// same uniforms and the same pass/channel arrangement as pattern_render.
+
+// An RGBA color, like a GLSL vec4; the compiler turns arithmetic on these into SIMD
+typedef float v4f __attribute__((vector_size(16)));
+
+// Straight (not premultiplied) alpha. Row 0 is at the bottom, as in OpenGL.
+struct soft_frame {
+    int width;
+    int height;
+    v4f * pixels;
+};
+
+#define SOFT_MAX_PASSES 4
+
+struct soft_uniforms {
+    float time;
+    float audio_hi;
+    float audio_mid;
+    float audio_low;
+    float audio_level;
+    float fps;
+    float intensity;
+    float intensity_integral;
+    float resolution[2];
+    const struct soft_frame * frame;                    // iFrame
+    const struct soft_frame * channel[SOFT_MAX_PASSES]; // iChannel
+};
+
+// Shade pixels [x0, x1) of row `y` into out[0 .. x1 - x0)
+typedef void (*soft_pass)(const struct soft_uniforms * u, int y, int x0, int x1, v4f * out);
+
+struct soft_kernel {
+    const char * name;
+    int n_passes;
+    bool stateful;  // Reads iChannel
+    bool fades;     // Pass-through at intensity 0
+    soft_pass pass[SOFT_MAX_PASSES];
+};
+
+// NULL-terminated
+extern const struct soft_kernel soft_kernels[];
+
+extern bool soft_enabled;
+
+void soft_init();
+void soft_term();
+
+struct soft_frame * soft_frame_new(int width, int height);
+void soft_frame_free(struct soft_frame * frame);
+
+struct pattern;
+int soft_pattern_init(struct pattern * pattern, const char * name);
+void soft_pattern_term(struct pattern * pattern);
+void soft_pattern_render(struct pattern * pattern, const struct soft_frame * input);
+
+// Blend the decks straight into `rgba` (8-bit, as glReadPixels would return it), in parallel tiles
+void soft_crossfade(uint8_t * rgba, int width, int height, const struct soft_frame * left,
+                    const struct soft_frame * right, float position, bool left_on_top);
+
+//
+// GLSL built-ins & resources/header.glsl utilities, for the kernels
+//
+
+static inline v4f v4f_splat(float x) {
+    return (v4f) {x, x, x, x};
+}
+
+static inline float soft_clamp(float x, float lo, float hi) {
+    return x < lo ? lo : x > hi ? hi : x;
+}
+
+static inline v4f v4f_clamp(v4f c, float lo, float hi) {
+    for(int i = 0; i < 4; i++) {
+        c[i] = fminf(fmaxf(c[i], lo), hi);
+    }
+    return c;
+}
+
+static inline float soft_smoothstep(float e0, float e1, float x) {
+    float t = soft_clamp((x - e0) / (e1 - e0), 0., 1.);
+    return t * t * (3. - 2. * t);
+}
+
+// GLSL mod: the result has the sign of y
+static inline float soft_mod(float x, float y) {
+    return x - y * floorf(x / y);
+}
+
+static inline float soft_mix(float a, float b, float t) {
+    return a + (b - a) * t;
+}
+
+static inline v4f v4f_mix(v4f a, v4f b, float t) {
+    return a + (b - a) * t;
+}
+
+static inline v4f soft_composite(v4f under, v4f over) {
+    float a_out = 1.f - (1.f - over[3]) * (1.f - under[3]);
+    v4f c = (over * over[3] + under * under[3] * (1.f - over[3])) / a_out;
+    c[3] = a_out;
+    return v4f_clamp(c, 0., 1.);
+}
+
+static inline float soft_sawtooth(float x, float t_up) {
+    x = soft_mod(x + t_up, 1.);
+    return x < t_up ? x / t_up : (1. - x) / (1. - t_up);
+}
+
+// Only .rgb is converted; .a is passed through
+static inline v4f soft_rgb2hsv(v4f c) {
+    float mx = fmaxf(c[0], fmaxf(c[1], c[2]));
+    float mn = fminf(c[0], fminf(c[1], c[2]));
+    float d = mx - mn;
+    float h = 0.;
+    if(d > 0.) {
+        if(mx == c[0]) h = soft_mod((c[1] - c[2]) / d, 6.);
+        else if(mx == c[1]) h = (c[2] - c[0]) / d + 2.;
+        else h = (c[0] - c[1]) / d + 4.;
+        h /= 6.;
+    }
+    return (v4f) {h, d / (mx + 1.0e-10), mx, c[3]};
+}
+
+static inline v4f soft_hsv2rgb(v4f c) {
+    v4f k = {1., 2. / 3., 1. / 3., 0.};
+    v4f rgb;
+    for(int i = 0; i < 3; i++) {
+        float p = fabsf(soft_mod(c[0] + k[i], 1.f) * 6.f - 3.f);
+        rgb[i] = c[2] * soft_mix(1., soft_clamp(p - 1., 0., 1.), c[1]);
+    }
+    rgb[3] = c[3];
+    return rgb;
+}
+
+// texture2D with GL_LINEAR filtering and GL_CLAMP_TO_EDGE
+v4f soft_texture(const struct soft_frame * frame, float u, float v);
+
+// The texel under pixel (x, y) of a frame the same size as the one being shaded
+static inline v4f soft_texel(const struct soft_frame * frame, int x, int y) {
+    return frame->pixels[y * frame->width + x];
+}
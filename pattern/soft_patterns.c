@@ -0,0 +1,211 @@
+#include "pattern/soft.h"
+
+#include <stddef.h>
+
+// C ports of a core subset of resources/patterns. Each function is pass N of NAME.N.glsl;
+// keep them in step with the GLSL.
+
+// texture2D(frame, uv) at the center of pixel (x, y)
+static inline v4f sample(const struct soft_uniforms * u, const struct soft_frame * frame, int x, int y) {
+    if(frame->width == u->resolution[0] && frame->height == u->resolution[1])
+        return soft_texel(frame, x, y);
+    return soft_texture(frame, (x + 0.5) / u->resolution[0], (y + 0.5) / u->resolution[1]);
+}
+
+// allwhite: Basic white fill
+static void allwhite_0(const struct soft_uniforms * u, int y, int x0, int x1, v4f * out) {
+    v4f c = {1., 1., 1., u->intensity};
+    for(int x = x0; x < x1; x++) {
+        *out++ = soft_composite(sample(u, u->frame, x, y), c);
+    }
+}
+
+// black: Reduce alpha
+static void black_0(const struct soft_uniforms * u, int y, int x0, int x1, v4f * out) {
+    for(int x = x0; x < x1; x++) {
+        v4f c = sample(u, u->frame, x, y);
+        c[3] *= 1. - u->intensity;
+        *out++ = c;
+    }
+}
+
+// circle: Yellow blob that spins to the beat
+static void circle_0(const struct soft_uniforms * u, int y, int x0, int x1, v4f * out) {
+    float t = u->time / 4.;
+    float radius = u->audio_level * 0.9 + 0.1;
+    float cx = sinf(t) * radius + 0.5;
+    float cy = cosf(t) * radius + 0.5;
+    float power = u->audio_hi * 3. + 0.1;
+    float uvy = (y + 0.5) / u->resolution[1];
+
+    for(int x = x0; x < x1; x++) {
+        float uvx = (x + 0.5) / u->resolution[0];
+        float a = soft_clamp(hypotf(cx - uvx, cy - uvy), 0., 1.);
+        v4f c = {1., 1., 0., (1. - powf(a, power)) * u->intensity};
+        *out++ = soft_composite(sample(u, u->frame, x, y), c);
+    }
+}
+
+// cyan: Cyan diagonal stripes
+static void cyan_0(const struct soft_uniforms * u, int y, int x0, int x1, v4f * out) {
+    float uvy = (y + 0.5) / u->resolution[1];
+    float g_alpha = soft_smoothstep(0.5, 0.8, u->intensity);
+    float alpha = soft_smoothstep(0., 0.1, u->intensity);
+
+    for(int x = x0; x < x1; x++) {
+        float uvx = (x + 0.5) / u->resolution[0];
+        float t = uvx * 3. + uvy * 3.;
+        float yc = soft_smoothstep(0.2, 0.7, fabsf(soft_mod(t - 3.f * u->intensity_integral, 2.f) - 1.f));
+        float g = soft_smoothstep(0.5, 0.9, fabsf(soft_mod(1.f + t - 3.f * u->intensity_integral, 2.f) - 1.f));
+
+        v4f c = soft_composite((v4f) {0., 1., 1., yc}, (v4f) {0., 0., 1., g * g_alpha});
+        c[3] *= alpha;
+        c = v4f_clamp(c, 0., 1.);
+        *out++ = soft_composite(sample(u, u->frame, x, y), c);
+    }
+}
+
+// pink: Pink polka dots
+static void pink_0(const struct soft_uniforms * u, int y, int x0, int x1, v4f * out) {
+    const float r = 0.2;
+    float uvy = (y + 0.5) / u->resolution[1];
+    float alpha = soft_smoothstep(0., 0.2, u->intensity);
+    float dy = soft_mod((uvy - 0.5) * 5. * u->intensity - 0.5, 1.) - 0.5;
+
+    for(int x = x0; x < x1; x++) {
+        float uvx = (x + 0.5) / u->resolution[0];
+        float dx = soft_mod((uvx - 0.5) * 5. * u->intensity - 0.5, 1.) - 0.5;
+        v4f c = {1., 0.5, 0.5, (1. - soft_smoothstep(r - 0.1, r, hypotf(dx, dy))) * alpha};
+        *out++ = soft_composite(sample(u, u->frame, x, y), c);
+    }
+}
+
+// purple: Organic purple waves
+static void purple_0(const struct soft_uniforms * u, int y, int x0, int x1, v4f * out) {
+    float uvy = (y + 0.5) / u->resolution[1];
+    float wave = cosf(u->time / 4.) * uvy * 8.;
+
+    for(int x = x0; x < x1; x++) {
+        float uvx = (x + 0.5) / u->resolution[0];
+        float s = sinf(wave + uvx);
+        float yv = s * s;
+        float xv = soft_mod(sinf(uvx * 4.) + cosf(uvy * uvx * 5.) * (yv * 0.2 + 0.8) + 3.0, 1.0);
+
+        v4f c = {soft_mix(xv, yv, 0.3), 0., powf(soft_mix(xv, yv, 0.7), 0.6), u->intensity};
+        *out++ = soft_composite(sample(u, u->frame, x, y), c);
+    }
+}
+
+// rainbow: Cycle the color (in HSV) over time
+static void rainbow_0(const struct soft_uniforms * u, int y, int x0, int x1, v4f * out) {
+    float deviation = soft_mod(u->intensity_integral, 1.);
+    float amount = soft_smoothstep(0., 0.2, u->intensity);
+
+    for(int x = x0; x < x1; x++) {
+        v4f c = sample(u, u->frame, x, y);
+        v4f hsv = soft_rgb2hsv(c);
+        hsv[0] = soft_mod(hsv[0] + 1. + deviation, 1.);
+        v4f rgb = v4f_mix(c, soft_hsv2rgb(hsv), amount);
+        rgb[3] = c[3];
+        *out++ = rgb;
+    }
+}
+
+// hue: Shift the color in HSV space
+static void hue_0(const struct soft_uniforms * u, int y, int x0, int x1, v4f * out) {
+    for(int x = x0; x < x1; x++) {
+        v4f hsv = soft_rgb2hsv(sample(u, u->frame, x, y));
+        hsv[0] = soft_mod(hsv[0] + u->intensity, 1.);
+        *out++ = soft_hsv2rgb(hsv);
+    }
+}
+
+// desat: Desaturate (make white)
+static void desat_0(const struct soft_uniforms * u, int y, int x0, int x1, v4f * out) {
+    float factor = u->intensity * u->intensity * u->intensity;
+
+    for(int x = x0; x < x1; x++) {
+        v4f hsv = soft_rgb2hsv(sample(u, u->frame, x, y));
+        hsv[1] *= 1. - factor;
+        *out++ = soft_hsv2rgb(hsv);
+    }
+}
+
+// posterize: Reduce number of colors
+static void posterize_0(const struct soft_uniforms * u, int y, int x0, int x1, v4f * out) {
+    float bins = u->intensity > 1. / 256. ? 1. / u->intensity : 256.;
+
+    for(int x = x0; x < x1; x++) {
+        v4f c = sample(u, u->frame, x, y) * bins;
+        for(int k = 0; k < 4; k++) {
+            c[k] = roundf(c[k]);
+        }
+        *out++ = c / bins;
+    }
+}
+
+// bstrobe: Full black strobe. Intensity increases frequency
+static void bstrobe_0(const struct soft_uniforms * u, int y, int x0, int x1, v4f * out) {
+    float freq;
+    if(u->intensity < 0.05) freq = 0.;
+    else if(u->intensity < 0.15) freq = 4.;
+    else if(u->intensity < 0.25) freq = 2.;
+    else if(u->intensity < 0.35) freq = 1.;
+    else if(u->intensity < 0.45) freq = 0.5;
+    else if(u->intensity < 0.55) freq = 0.25;
+    else if(u->intensity < 0.65) freq = 0.125;
+    else if(u->intensity < 0.75) freq = 0.0625;
+    else freq = 0.03125;
+
+    v4f c = {0., 0., 0., freq > 0 ? 1. - soft_mod(u->time, freq) / freq : 0.};
+    for(int x = x0; x < x1; x++) {
+        v4f in = sample(u, u->frame, x, y);
+        *out++ = freq > 0 ? soft_composite(in, c) : in;
+    }
+}
+
+// strobe: Strobe alpha to the beat
+static void strobe_0(const struct soft_uniforms * u, int y, int x0, int x1, v4f * out) {
+    float freq;
+    if(u->intensity < 0.05) freq = 0.;
+    else if(u->intensity < 0.45) freq = 2.;
+    else freq = 1.;
+
+    float scale = 1.;
+    if(freq > 0)
+        scale = 1. - ((1. - soft_sawtooth(u->time / freq, 0.2)) * u->intensity * fminf(3. * u->audio_level, 1.));
+    for(int x = x0; x < x1; x++) {
+        v4f c = sample(u, u->frame, x, y);
+        c[3] *= scale;
+        *out++ = c;
+    }
+}
+
+// lpf: Smooth output
+static void lpf_0(const struct soft_uniforms * u, int y, int x0, int x1, v4f * out) {
+    float amount = powf(u->intensity, 0.4);
+
+    for(int x = x0; x < x1; x++) {
+        v4f prev = sample(u, u->channel[0], x, y);
+        v4f next = sample(u, u->frame, x, y);
+        prev[3] *= 0.98;
+        *out++ = v4f_mix(next, prev, amount);
+    }
+}
+
+const struct soft_kernel soft_kernels[] = {
+    {.name = "allwhite", .n_passes = 1, .fades = true, .pass = {allwhite_0}},
+    {.name = "black", .n_passes = 1, .fades = true, .pass = {black_0}},
+    {.name = "bstrobe", .n_passes = 1, .fades = true, .pass = {bstrobe_0}},
+    {.name = "circle", .n_passes = 1, .fades = true, .pass = {circle_0}},
+    {.name = "cyan", .n_passes = 1, .fades = true, .pass = {cyan_0}},
+    {.name = "desat", .n_passes = 1, .fades = true, .pass = {desat_0}},
+    {.name = "hue", .n_passes = 1, .fades = true, .pass = {hue_0}},
+    {.name = "lpf", .n_passes = 1, .stateful = true, .fades = true, .pass = {lpf_0}},
+    {.name = "pink", .n_passes = 1, .fades = true, .pass = {pink_0}},
+    {.name = "posterize", .n_passes = 1, .fades = true, .pass = {posterize_0}},
+    {.name = "purple", .n_passes = 1, .fades = true, .pass = {purple_0}},
+    {.name = "rainbow", .n_passes = 1, .fades = true, .pass = {rainbow_0}},
+    {.name = "strobe", .n_passes = 1, .fades = true, .pass = {strobe_0}},
+    {.name = NULL},
+};
@@ -0,0 +1,158 @@
+#include "pattern/texpool.h"
+#include "util/config.h"
+#include "util/err.h"
+
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+
+struct texpool_entry {
+    struct texpool_entry * next;
+    GLuint tex;
+    int width;
+    int height;
+    int refs;
+};
+
+static struct texpool_entry * pool_head = NULL;
+static int pool_idle = 0;
+static int pool_size = 0;
+// Patterns are also loaded from the pattern loader thread
+static SDL_SpinLock pool_lock = 0;
+
+static GLuint pool_fb = 0;
+static GLuint pool_read_fb = 0;
+
+GLuint texpool_get(int width, int height) {
+    SDL_AtomicLock(&pool_lock);
+    for(struct texpool_entry * e = pool_head; e != NULL; e = e->next) {
+        if(e->refs == 0 && e->width == width && e->height == height) {
+            e->refs = 1;
+            pool_idle--;
+            SDL_AtomicUnlock(&pool_lock);
+            return e->tex;
+        }
+    }
+    SDL_AtomicUnlock(&pool_lock);
+
+    GLenum e;
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+
+    struct texpool_entry * entry = calloc(1, sizeof *entry);
+    if(entry == NULL) MEMFAIL();
+    entry->tex = tex;
+    entry->width = width;
+    entry->height = height;
+    entry->refs = 1;
+
+    SDL_AtomicLock(&pool_lock);
+    entry->next = pool_head;
+    pool_head = entry;
+    pool_size++;
+    SDL_AtomicUnlock(&pool_lock);
+    DEBUG("Texture pool grew to %d textures (new one is %dx%d)", pool_size, width, height);
+    return tex;
+}
+
+void texpool_ref(GLuint tex) {
+    SDL_AtomicLock(&pool_lock);
+    for(struct texpool_entry * e = pool_head; e != NULL; e = e->next) {
+        if(e->tex == tex) {
+            e->refs++;
+            break;
+        }
+    }
+    SDL_AtomicUnlock(&pool_lock);
+}
+
+void texpool_put(GLuint tex) {
+    if(tex == 0) return;
+
+    SDL_AtomicLock(&pool_lock);
+    struct texpool_entry ** prev = &pool_head;
+    for(struct texpool_entry * e = pool_head; e != NULL; prev = &e->next, e = e->next) {
+        if(e->tex != tex) continue;
+        if(e->refs <= 0) {
+            SDL_AtomicUnlock(&pool_lock);
+            WARN("Texture %u returned to the pool twice", tex);
+            return;
+        }
+        if(--e->refs > 0) break;
+
+        if(pool_idle < config.pattern.texture_pool) {
+            pool_idle++;
+            break;
+        }
+        // Pool is full; really free it
+        *prev = e->next;
+        pool_size--;
+        SDL_AtomicUnlock(&pool_lock);
+        glDeleteTextures(1, &e->tex);
+        free(e);
+        return;
+    }
+    SDL_AtomicUnlock(&pool_lock);
+}
+
+void texpool_term() {
+    GLenum e;
+
+    // Nothing to do (and maybe no OpenGL context) if nothing was ever allocated
+    if(pool_head == NULL && pool_fb == 0 && pool_read_fb == 0) return;
+
+    while(pool_head != NULL) {
+        struct texpool_entry * entry = pool_head;
+        pool_head = entry->next;
+        if(entry->refs > 0) WARN("Texture %u still in use", entry->tex);
+        glDeleteTextures(1, &entry->tex);
+        free(entry);
+    }
+    pool_idle = 0;
+    pool_size = 0;
+
+    if(pool_fb != 0) glDeleteFramebuffersEXT(1, &pool_fb);
+    if(pool_read_fb != 0) glDeleteFramebuffersEXT(1, &pool_read_fb);
+    pool_fb = 0;
+    pool_read_fb = 0;
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+}
+
+GLuint texpool_framebuffer() {
+    if(pool_fb == 0) glGenFramebuffersEXT(1, &pool_fb);
+    return pool_fb;
+}
+
+void texpool_clear(const GLuint * tex, int n) {
+    GLenum e;
+
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, texpool_framebuffer());
+    for(int i = 0; i < n; i++) {
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D,
+                                  tex[i], 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+}
+
+void texpool_copy(GLuint from, int from_width, int from_height, GLuint to, int to_width, int to_height) {
+    GLenum e;
+
+    if(pool_read_fb == 0) glGenFramebuffersEXT(1, &pool_read_fb);
+    glBindFramebufferEXT(GL_READ_FRAMEBUFFER_EXT, pool_read_fb);
+    glFramebufferTexture2DEXT(GL_READ_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, from, 0);
+    glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT, texpool_framebuffer());
+    glFramebufferTexture2DEXT(GL_DRAW_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, to, 0);
+    glBlitFramebufferEXT(0, 0, from_width, from_height, 0, 0, to_width, to_height,
+                         GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+}
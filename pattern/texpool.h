@@ -0,0 +1,27 @@
+#pragma once
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+#include "util/opengl.h"
+
+// Pool of RGBA render targets, shared by patterns, decks and the crossfader.
+// Most are master-size; decks rendering at reduced resolution use smaller ones.
+//
+// Textures are reference counted; when the last reference is dropped they are kept
+// for reuse (up to `[pattern] texture_pool` of them) instead of being deleted, so
+// swapping patterns doesn't allocate anything in the driver.
+
+void texpool_term();
+
+// Safe to call from the pattern loader thread.
+// New textures have refs = 1 and undefined contents; see texpool_clear.
+GLuint texpool_get(int width, int height);
+void texpool_ref(GLuint tex);
+void texpool_put(GLuint tex);
+
+// Render thread only: a framebuffer to attach pool textures to while rendering.
+// It is shared by everything, so re-attach before each use.
+GLuint texpool_framebuffer();
+void texpool_clear(const GLuint * tex, int n);
+// Scale the contents of one texture into another
+void texpool_copy(GLuint from, int from_width, int from_height, GLuint to, int to_width, int to_height);
@@ -1,5 +1,7 @@
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
+    // Rendering one texel per output point: look up where it is on the canvas
+    if(iSampled) uv = texture2D(iCoords, uv).xy;
 
     float left_alpha = min((1. - iIntensity) * 2., 1.);
     float right_alpha = min(iIntensity * 2., 1.);
@@ -1,13 +1,32 @@
 #version 120
 
+// Per-frame values, shared by every pattern.
+// Where supported, these are updated once per frame in a uniform buffer;
+// the layout must match `struct pattern_globals` in pattern/pattern.h
+#ifdef GL_ARB_uniform_buffer_object
+#extension GL_ARB_uniform_buffer_object : enable
+#define GLOBAL
+layout(std140) uniform Globals {
+#else
+#define GLOBAL uniform
+#endif
+
 // Time, measured in beats. Wraps around to 0 every 16 beats, [0.0, 16.0)
-uniform float iTime;
+GLOBAL float iTime;
 
 // Audio levels, high/mid/low/level, [0.0, 1.0]
-uniform float iAudioHi;
-uniform float iAudioLow;
-uniform float iAudioMid;
-uniform float iAudioLevel;
+GLOBAL float iAudioHi;
+GLOBAL float iAudioMid;
+GLOBAL float iAudioLow;
+GLOBAL float iAudioLevel;
+
+// (Ideal) output rate in frames per second
+GLOBAL float iFPS;
+
+#ifdef GL_ARB_uniform_buffer_object
+};
+#endif
+#undef GLOBAL
 
 // Resolution of the output pattern
 uniform vec2 iResolution;
@@ -18,9 +37,6 @@ uniform float iIntensity;
 // Intensity slider integrated with respect to wall time mod 1024, [0.0, 1024.0)
 uniform float iIntensityIntegral;
 
-// (Ideal) output rate in frames per second
-uniform float iFPS;
-
 // Output of the previous pattern
 uniform sampler2D iFrame;
 
@@ -123,6 +139,7 @@ float noise(vec3 p) {
 //
 
 uniform bool iLeftOnTop;
+uniform bool iSampled;
 uniform bool iSelection;
 uniform int iBins;
 uniform int iLeftDeckSelector;
@@ -134,6 +151,7 @@ uniform int iIndicator;
 uniform sampler1D iSpectrum;
 uniform sampler1D iWaveform;
 uniform sampler1D iBeats;
+uniform sampler2D iCoords;
 uniform sampler2D iFrameLeft;
 uniform sampler2D iFrameRight;
 uniform sampler2D iPreview;
@@ -0,0 +1,363 @@
+#include "ui/control.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_thread.h>
+
+#include "main.h"
+#include "util/config.h"
+#include "util/err.h"
+#include "util/ring.h"
+#include "util/string.h"
+
+#define CONTROL_MAX_CLIENTS 8
+#define CONTROL_QUEUE_SIZE 64
+#define CONTROL_LINE_SIZE 512
+#define CONTROL_MAX_ARGS 5
+
+static const char control_help[] =
+    "ok commands: load DECK SLOT PATTERN [INTENSITY]; unload DECK SLOT; intensity DECK SLOT VALUE; "
+    "crossfader VALUE; select LEFT_DECK RIGHT_DECK; deck_load DECK NAME; deck_save DECK NAME; reload [all]; profile PATH\n";
+
+struct control_client {
+    int fd;
+    unsigned int id;
+    size_t length;
+    char line[CONTROL_LINE_SIZE];
+};
+
+static volatile int control_running = 0;
+static SDL_Thread * control_thread;
+static int listen_fd = -1;
+static int wake_fds[2] = {-1, -1};
+static struct control_client clients[CONTROL_MAX_CLIENTS];
+static unsigned int next_client_id = 1;
+
+// Commands waiting for the UI thread, and commands it has finished with.
+// At most CONTROL_QUEUE_SIZE commands are in flight, so neither ring can overflow.
+static struct ring pending;
+static struct ring done;
+static unsigned int n_in_flight = 0;
+
+static void control_reply(struct control_client * client, const char * reply) {
+    if(send(client->fd, reply, strlen(reply), MSG_NOSIGNAL) < 0)
+        DEBUG("Unable to reply to control client: %s", strerror(errno));
+}
+
+static int parse_int(const char * s, int min, int max, int * out) {
+    char * end;
+    long x = strtol(s, &end, 10);
+    if(end == s || *end != '\0' || x < min || x >= max) return -1;
+    *out = x;
+    return 0;
+}
+
+static int parse_float(const char * s, float * out) {
+    char * end;
+    *out = strtof(s, &end);
+    return (end == s || *end != '\0') ? -1 : 0;
+}
+
+static int parse_name(const char * s, char * out) {
+    if(strlen(s) >= CONTROL_NAME_SIZE) return -1;
+    strcpy(out, s);
+    return 0;
+}
+
+// Returns NULL and sets `error` if `line` isn't a valid command
+static struct control_command * control_parse(char * line, const char ** error) {
+    char * argv[CONTROL_MAX_ARGS];
+    int argc = 0;
+    char * tok;
+    while((tok = strsep(&line, " \t\r")) != NULL) {
+        if(*tok == '\0') continue;
+        if(argc == CONTROL_MAX_ARGS) {
+            *error = "error too many arguments\n";
+            return NULL;
+        }
+        argv[argc++] = tok;
+    }
+    *error = NULL;
+    if(argc == 0) return NULL;
+
+    struct control_command * c = calloc(1, sizeof *c);
+    if(c == NULL) MEMFAIL();
+    c->value = -1;
+
+    const char * cmd = argv[0];
+    int n = config.deck.n_patterns;
+    int rc = -1;
+    if(strcmp(cmd, "load") == 0 && (argc == 4 || argc == 5)) {
+        c->type = CONTROL_LOAD;
+        rc = parse_int(argv[1], 0, N_DECKS, &c->deck) || parse_int(argv[2], 0, n, &c->slot)
+          || parse_name(argv[3], c->name) || (argc == 5 && parse_float(argv[4], &c->value));
+    } else if(strcmp(cmd, "unload") == 0 && argc == 3) {
+        c->type = CONTROL_UNLOAD;
+        rc = parse_int(argv[1], 0, N_DECKS, &c->deck) || parse_int(argv[2], 0, n, &c->slot);
+    } else if(strcmp(cmd, "intensity") == 0 && argc == 4) {
+        c->type = CONTROL_INTENSITY;
+        rc = parse_int(argv[1], 0, N_DECKS, &c->deck) || parse_int(argv[2], 0, n, &c->slot)
+          || parse_float(argv[3], &c->value);
+    } else if(strcmp(cmd, "crossfader") == 0 && argc == 2) {
+        c->type = CONTROL_CROSSFADER;
+        rc = parse_float(argv[1], &c->value);
+    } else if(strcmp(cmd, "select") == 0 && argc == 3) {
+        c->type = CONTROL_SELECT;
+        rc = parse_int(argv[1], 0, N_DECKS, &c->deck) || parse_int(argv[2], 0, N_DECKS, &c->slot);
+    } else if(strcmp(cmd, "deck_load") == 0 && argc == 3) {
+        c->type = CONTROL_DECK_LOAD;
+        rc = parse_int(argv[1], 0, N_DECKS, &c->deck) || parse_name(argv[2], c->name);
+    } else if(strcmp(cmd, "deck_save") == 0 && argc == 3) {
+        c->type = CONTROL_DECK_SAVE;
+        rc = parse_int(argv[1], 0, N_DECKS, &c->deck) || parse_name(argv[2], c->name);
+    } else if(strcmp(cmd, "reload") == 0 && (argc == 1 || (argc == 2 && strcmp(argv[1], "all") == 0))) {
+        c->type = CONTROL_RELOAD;
+        c->slot = argc == 2;
+        rc = 0;
+    } else if(strcmp(cmd, "profile") == 0 && argc == 2) {
+        c->type = CONTROL_PROFILE;
+        rc = parse_name(argv[1], c->name);
+    } else if(strcmp(cmd, "help") == 0) {
+        *error = control_help;
+    }
+
+    if(rc != 0) {
+        free(c);
+        if(*error == NULL) *error = "error invalid command (try 'help')\n";
+        return NULL;
+    }
+    return c;
+}
+
+static void control_close_client(struct control_client * client) {
+    close(client->fd);
+    client->fd = -1;
+    client->length = 0;
+}
+
+static void control_handle_line(struct control_client * client, char * line) {
+    const char * error;
+    struct control_command * c = control_parse(line, &error);
+    if(c == NULL) {
+        if(error != NULL) control_reply(client, error);
+        return;
+    }
+    if(n_in_flight >= CONTROL_QUEUE_SIZE) {
+        free(c);
+        control_reply(client, "error busy\n");
+        return;
+    }
+    c->client_id = client->id;
+    ring_push(&pending, c);
+    n_in_flight++;
+}
+
+static void control_read_client(struct control_client * client) {
+    ssize_t n = read(client->fd, client->line + client->length, CONTROL_LINE_SIZE - 1 - client->length);
+    if(n <= 0) {
+        if(n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+        control_close_client(client);
+        return;
+    }
+    client->length += n;
+    client->line[client->length] = '\0';
+
+    char * start = client->line;
+    char * newline;
+    while((newline = strchr(start, '\n')) != NULL) {
+        *newline = '\0';
+        control_handle_line(client, start);
+        start = newline + 1;
+    }
+    client->length -= start - client->line;
+    memmove(client->line, start, client->length);
+
+    if(client->length == CONTROL_LINE_SIZE - 1) {
+        control_reply(client, "error line too long\n");
+        control_close_client(client);
+    }
+}
+
+static void control_accept() {
+    int fd = accept(listen_fd, NULL, NULL);
+    if(fd < 0) {
+        PERROR("Unable to accept control connection");
+        return;
+    }
+    for(int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if(clients[i].fd >= 0) continue;
+        clients[i].fd = fd;
+        clients[i].id = next_client_id++;
+        clients[i].length = 0;
+        return;
+    }
+    static const char full[] = "error too many clients\n";
+    send(fd, full, sizeof full - 1, MSG_NOSIGNAL);
+    close(fd);
+}
+
+static void control_send_replies() {
+    char buf[64];
+    while(read(wake_fds[0], buf, sizeof buf) == sizeof buf);
+
+    struct control_command * c;
+    while((c = ring_pop(&done)) != NULL) {
+        n_in_flight--;
+        // The client may have disconnected in the meantime
+        for(int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+            if(clients[i].fd >= 0 && clients[i].id == c->client_id)
+                control_reply(&clients[i], c->result == 0 ? "ok\n" : "error command failed\n");
+        }
+        free(c);
+    }
+}
+
+static int control_run(void * args) {
+    struct pollfd fds[CONTROL_MAX_CLIENTS + 2];
+
+    while(control_running) {
+        fds[0] = (struct pollfd) {.fd = listen_fd, .events = POLLIN};
+        fds[1] = (struct pollfd) {.fd = wake_fds[0], .events = POLLIN};
+        for(int i = 0; i < CONTROL_MAX_CLIENTS; i++)
+            fds[i + 2] = (struct pollfd) {.fd = clients[i].fd, .events = POLLIN};
+
+        if(poll(fds, CONTROL_MAX_CLIENTS + 2, 100) < 0) {
+            if(errno == EINTR) continue;
+            PERROR("Control socket poll failed");
+            break;
+        }
+        if(fds[1].revents) control_send_replies();
+        for(int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+            if(clients[i].fd >= 0 && fds[i + 2].revents)
+                control_read_client(&clients[i]);
+        }
+        if(fds[0].revents & POLLIN) control_accept();
+    }
+    return 0;
+}
+
+// Remove a socket left behind by an instance that didn't shut down cleanly. Anything else
+// at the path, including a socket that another instance is still listening on, is left alone.
+static int control_clear_stale(const struct sockaddr_un * addr) {
+    struct stat st;
+    if(lstat(addr->sun_path, &st) < 0) {
+        if(errno == ENOENT) return 0;
+        PERROR("Unable to stat control socket '%s'", addr->sun_path);
+        return -1;
+    }
+    if(!S_ISSOCK(st.st_mode)) {
+        ERROR("Control socket path '%s' exists and is not a socket", addr->sun_path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        PERROR("Unable to create control socket");
+        return -1;
+    }
+    int rc = connect(fd, (const struct sockaddr *) addr, sizeof *addr);
+    int err = errno;
+    close(fd);
+    if(rc == 0) {
+        ERROR("Control socket '%s' is already in use", addr->sun_path);
+        return -1;
+    }
+    if(err != ECONNREFUSED) {
+        errno = err;
+        PERROR("Unable to check control socket '%s'", addr->sun_path);
+        return -1;
+    }
+    if(unlink(addr->sun_path) < 0 && errno != ENOENT) {
+        PERROR("Unable to remove stale control socket '%s'", addr->sun_path);
+        return -1;
+    }
+    return 0;
+}
+
+void control_start() {
+    for(int i = 0; i < CONTROL_MAX_CLIENTS; i++)
+        clients[i].fd = -1;
+    if(!config.control.enabled) return;
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if(strlen(config.control.path) >= sizeof addr.sun_path) {
+        ERROR("Control socket path '%s' is too long", config.control.path);
+        return;
+    }
+    strcpy(addr.sun_path, config.control.path);
+
+    if(control_clear_stale(&addr) < 0) return;
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listen_fd < 0) {
+        PERROR("Unable to create control socket");
+        return;
+    }
+    if(bind(listen_fd, (struct sockaddr *) &addr, sizeof addr) < 0 || listen(listen_fd, CONTROL_MAX_CLIENTS) < 0) {
+        PERROR("Unable to listen on control socket '%s'", addr.sun_path);
+        goto fail;
+    }
+    if(pipe(wake_fds) < 0) {
+        PERROR("Unable to create control pipe");
+        goto fail;
+    }
+    fcntl(wake_fds[0], F_SETFL, O_NONBLOCK);
+    n_in_flight = 0;
+
+    ring_init(&pending, CONTROL_QUEUE_SIZE);
+    ring_init(&done, CONTROL_QUEUE_SIZE);
+
+    control_running = 1;
+    control_thread = SDL_CreateThread(&control_run, "Control", 0);
+    if(!control_thread) FAIL("Could not create control thread: %s", SDL_GetError());
+    INFO("Listening for commands on '%s'", addr.sun_path);
+    return;
+
+fail:
+    close(listen_fd);
+    listen_fd = -1;
+}
+
+void control_stop() {
+    if(!control_running) return;
+    control_running = 0;
+    SDL_WaitThread(control_thread, 0);
+
+    for(int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if(clients[i].fd >= 0) control_close_client(&clients[i]);
+    }
+    void * c;
+    while((c = ring_pop(&pending)) != NULL) free(c);
+    while((c = ring_pop(&done)) != NULL) free(c);
+    ring_term(&pending);
+    ring_term(&done);
+
+    close(wake_fds[0]);
+    close(wake_fds[1]);
+    wake_fds[0] = wake_fds[1] = -1;
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(config.control.path);
+}
+
+struct control_command * control_poll() {
+    if(!control_running) return NULL;
+    return ring_pop(&pending);
+}
+
+void control_done(struct control_command * command, int rc) {
+    command->result = rc;
+    ring_push(&done, command);
+    if(write(wake_fds[1], "", 1) < 0)
+        DEBUG("Unable to wake control thread: %s", strerror(errno));
+}
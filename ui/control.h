@@ -0,0 +1,40 @@
+#pragma once
+
+// Local control socket.
+//
+// Clients connect to the Unix domain socket at `[control] path` and send one
+// command per line; each command is answered with a line starting with "ok" or
+// "error". Commands are parsed on the control thread and executed by the UI
+// thread between frames (see `control_poll`).
+
+#define CONTROL_NAME_SIZE 256
+
+struct control_command {
+    enum control_type {
+        CONTROL_LOAD,           // load DECK SLOT PATTERN [INTENSITY]
+        CONTROL_UNLOAD,         // unload DECK SLOT
+        CONTROL_INTENSITY,      // intensity DECK SLOT VALUE
+        CONTROL_CROSSFADER,     // crossfader VALUE
+        CONTROL_SELECT,         // select LEFT_DECK RIGHT_DECK (stored in `deck` and `slot`)
+        CONTROL_DECK_LOAD,      // deck_load DECK NAME
+        CONTROL_DECK_SAVE,      // deck_save DECK NAME
+        CONTROL_RELOAD,         // reload [all]
+        CONTROL_PROFILE,        // profile PATH (write a trace of recent frames)
+    } type;
+    int deck;
+    int slot;
+    float value;                // Intensity or crossfader position
+    char name[CONTROL_NAME_SIZE];
+
+    // Private to the control thread
+    unsigned int client_id;
+    int result;
+};
+
+void control_start();
+void control_stop();
+
+// Only to be called from the UI thread. Returns NULL when no commands are pending.
+struct control_command * control_poll();
+// Return a command from `control_poll` with its result (0 on success, -1 on error)
+void control_done(struct control_command * command, int rc);
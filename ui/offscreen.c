@@ -0,0 +1,149 @@
+#include "ui/offscreen.h"
+
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include "util/err.h"
+
+#ifdef RADIANCE_EGL
+#include <EGL/egl.h>
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLConfig egl_config;
+static EGLSurface surface = EGL_NO_SURFACE;
+static EGLContext context = EGL_NO_CONTEXT;
+
+// Everything is drawn into FBOs, so the pbuffers themselves are never used
+static const EGLint pbuffer_attribs[] = {
+    EGL_WIDTH, 1,
+    EGL_HEIGHT, 1,
+    EGL_NONE
+};
+
+struct offscreen_shared {
+    EGLSurface surface;
+    EGLContext context;
+};
+
+void offscreen_init() {
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if(display == EGL_NO_DISPLAY) FAIL("Could not get EGL display: %#x\n", eglGetError());
+    if(!eglInitialize(display, NULL, NULL)) FAIL("Could not initialize EGL: %#x\n", eglGetError());
+
+    static const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_NONE
+    };
+    EGLint n_configs;
+    if(!eglChooseConfig(display, config_attribs, &egl_config, 1, &n_configs) || n_configs < 1)
+        FAIL("No suitable EGL config: %#x\n", eglGetError());
+
+    surface = eglCreatePbufferSurface(display, egl_config, pbuffer_attribs);
+    if(surface == EGL_NO_SURFACE) FAIL("Could not create EGL pbuffer: %#x\n", eglGetError());
+
+    if(!eglBindAPI(EGL_OPENGL_API)) FAIL("Could not bind OpenGL API: %#x\n", eglGetError());
+    context = eglCreateContext(display, egl_config, EGL_NO_CONTEXT, NULL);
+    if(context == EGL_NO_CONTEXT) FAIL("Could not create EGL context: %#x\n", eglGetError());
+    if(!eglMakeCurrent(display, surface, surface, context)) FAIL("Could not make EGL context current: %#x\n", eglGetError());
+
+    INFO("Running headless with an EGL pbuffer");
+}
+
+void offscreen_term() {
+    if(display == EGL_NO_DISPLAY) return;
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if(context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+    if(surface != EGL_NO_SURFACE) eglDestroySurface(display, surface);
+    eglTerminate(display);
+    context = EGL_NO_CONTEXT;
+    surface = EGL_NO_SURFACE;
+    display = EGL_NO_DISPLAY;
+}
+
+void * offscreen_shared_context_create() {
+    struct offscreen_shared * shared = calloc(1, sizeof *shared);
+    if(shared == NULL) MEMFAIL();
+
+    shared->surface = eglCreatePbufferSurface(display, egl_config, pbuffer_attribs);
+    if(shared->surface == EGL_NO_SURFACE) {
+        WARN("Could not create shared EGL pbuffer: %#x", eglGetError());
+        free(shared);
+        return NULL;
+    }
+    shared->context = eglCreateContext(display, egl_config, context, NULL);
+    if(shared->context == EGL_NO_CONTEXT) {
+        WARN("Could not create shared EGL context: %#x", eglGetError());
+        eglDestroySurface(display, shared->surface);
+        free(shared);
+        return NULL;
+    }
+    return shared;
+}
+
+int offscreen_shared_context_bind(void * ptr) {
+    struct offscreen_shared * shared = ptr;
+    // The API is per-thread
+    if(!eglBindAPI(EGL_OPENGL_API)) return -1;
+    if(shared == NULL)
+        return eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT) ? 0 : -1;
+    return eglMakeCurrent(display, shared->surface, shared->surface, shared->context) ? 0 : -1;
+}
+
+void offscreen_shared_context_destroy(void * ptr) {
+    struct offscreen_shared * shared = ptr;
+    if(shared == NULL) return;
+    eglDestroyContext(display, shared->context);
+    eglDestroySurface(display, shared->surface);
+    free(shared);
+}
+
+#else
+
+static SDL_Window * window;
+static SDL_GLContext context;
+
+void offscreen_init() {
+    if(SDL_InitSubSystem(SDL_INIT_VIDEO) < 0) FAIL("SDL could not initialize video! SDL Error: %s\n", SDL_GetError());
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 1);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
+
+    window = SDL_CreateWindow("Radiance", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1, 1, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+    if(window == NULL) FAIL("Hidden window could not be created: %s\n", SDL_GetError());
+    context = SDL_GL_CreateContext(window);
+    if(context == NULL) FAIL("OpenGL context could not be created: %s\n", SDL_GetError());
+
+    INFO("Running headless with a hidden window");
+}
+
+void offscreen_term() {
+    if(context != NULL) SDL_GL_DeleteContext(context);
+    if(window != NULL) SDL_DestroyWindow(window);
+    context = NULL;
+    window = NULL;
+    SDL_QuitSubSystem(SDL_INIT_VIDEO);
+}
+
+void * offscreen_shared_context_create() {
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+    SDL_GLContext shared = SDL_GL_CreateContext(window);
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+    if(shared == NULL) WARN("Could not create shared OpenGL context: %s", SDL_GetError());
+    // Creating a context makes it current
+    SDL_GL_MakeCurrent(window, context);
+    return shared;
+}
+
+int offscreen_shared_context_bind(void * shared) {
+    return SDL_GL_MakeCurrent(shared != NULL ? window : NULL, shared);
+}
+
+void offscreen_shared_context_destroy(void * shared) {
+    if(shared != NULL) SDL_GL_DeleteContext(shared);
+}
+
+#endif
@@ -0,0 +1,12 @@
+#pragma once
+
+// OpenGL context without a visible window, for running headless.
+// Uses an EGL pbuffer where available (no X server or compositor needed),
+// otherwise a hidden SDL window.
+void offscreen_init();
+void offscreen_term();
+
+// See ui_shared_context_create
+void * offscreen_shared_context_create();
+int offscreen_shared_context_bind(void * shared);
+void offscreen_shared_context_destroy(void * shared);
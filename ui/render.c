@@ -2,6 +2,9 @@
 
 #include "util/err.h"
 #include "util/config.h"
+#include "util/math.h"
+#include "pattern/soft.h"
+#include "pattern/texpool.h"
 
 #define BYTES_PER_PIXEL 4 // RGBA
 
@@ -12,21 +15,34 @@ void render_init(struct render * render, GLint texture) {
     render->pixels = calloc(config.pattern.master_width * config.pattern.master_height * BYTES_PER_PIXEL, sizeof(uint8_t));
     if(render->pixels == NULL) MEMFAIL();
 
-    glGenFramebuffersEXT(1, &render->fb);
-    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+    if(!soft_enabled) {
+        glGenFramebuffersEXT(1, &render->fb);
+        if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, render->fb);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, texture, 0);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, render->fb);
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, texture, 0);
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+        if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+    }
 
     render->mutex = SDL_CreateMutex();
     if(render->mutex == NULL) FAIL("Could not create mutex: %s\n", SDL_GetError());
+
+    render->tiles_w = (config.pattern.master_width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    render->tiles_h = (config.pattern.master_height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    render->coverage = calloc(render->tiles_w * render->tiles_h, sizeof *render->coverage);
+    if(render->coverage == NULL) MEMFAIL();
 }
 
 void render_term(struct render * render) {
     free(render->pixels);
-    glDeleteFramebuffersEXT(1, &render->fb);
+    free(render->coverage);
+    free(render->spans);
+    free(render->points);
+    free(render->samples);
+    if(render->sample_tex != 0) texpool_put(render->sample_tex);
+    if(render->coords_tex != 0) glDeleteTextures(1, &render->coords_tex);
+    if(render->fb != 0) glDeleteFramebuffersEXT(1, &render->fb);
     SDL_DestroyMutex(render->mutex);
     memset(render, 0, sizeof *render);
 }
@@ -34,6 +50,32 @@ void render_term(struct render * render) {
 void render_readback(struct render * render) {
     GLenum e;
 
+    // The software crossfader writes `pixels` directly
+    if(soft_enabled) return;
+
+    // Only the sampled points were rendered
+    if(render->n_samples > 0) {
+        if(SDL_TryLockMutex(render->mutex) == 0) {
+            size_t size = render->sample_width * render->sample_height * BYTES_PER_PIXEL;
+            if(render->samples_size < size) {
+                free(render->samples);
+                render->samples = malloc(size);
+                if(render->samples == NULL) MEMFAIL();
+                render->samples_size = size;
+            }
+            glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, texpool_framebuffer());
+            glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, render->sample_tex, 0);
+            glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+            glReadPixels(0, 0, render->sample_width, render->sample_height, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)render->samples);
+            glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+            if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+            render->n_samples_read = render->n_samples;
+            render->samples_gen = render->coords_gen;
+            SDL_UnlockMutex(render->mutex);
+        }
+        return;
+    }
+
     if(SDL_TryLockMutex(render->mutex) == 0) {
         glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, render->fb);
         glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
@@ -69,3 +111,189 @@ SDL_Color render_sample(struct render * render, float x, float y) {
     c.a = render->pixels[index + 3];
     return c;
 }
+
+void render_coverage_begin(struct render * render) {
+    SDL_AtomicLock(&render->coverage_lock);
+    memset(render->coverage, 0, render->tiles_w * render->tiles_h * sizeof *render->coverage);
+    render->n_points = 0;
+    SDL_AtomicUnlock(&render->coverage_lock);
+}
+
+void render_coverage_add(struct render * render, float x, float y) {
+    // Same mapping as render_sample, widened by the margin
+    int col = 0.5 * (x + 1) * config.pattern.master_width;
+    int row = 0.5 * (-y + 1) * config.pattern.master_height;
+    int margin = config.pattern.sparse_margin;
+    int c0 = MAX(col - margin, 0) / RENDER_TILE_SIZE;
+    int c1 = MIN(col + margin, config.pattern.master_width - 1) / RENDER_TILE_SIZE;
+    int r0 = MAX(row - margin, 0) / RENDER_TILE_SIZE;
+    int r1 = MIN(row + margin, config.pattern.master_height - 1) / RENDER_TILE_SIZE;
+
+    SDL_AtomicLock(&render->coverage_lock);
+    for(int r = r0; r <= r1; r++) {
+        for(int c = c0; c <= c1; c++) {
+            render->coverage[r * render->tiles_w + c] = 1;
+        }
+    }
+    if(config.pattern.led_only) {
+        if(render->n_points == render->points_size) {
+            render->points_size = render->points_size ? 2 * render->points_size : 1024;
+            GLfloat * points = realloc(render->points, render->points_size * 2 * sizeof *points);
+            if(points == NULL) MEMFAIL();
+            render->points = points;
+        }
+        // The center of the pixel render_sample would read
+        col = CLAMP(col, 0, config.pattern.master_width - 1);
+        row = CLAMP(row, 0, config.pattern.master_height - 1);
+        render->points[2 * render->n_points] = (col + 0.5) / config.pattern.master_width;
+        render->points[2 * render->n_points + 1] = (row + 0.5) / config.pattern.master_height;
+        render->n_points++;
+    }
+    SDL_AtomicUnlock(&render->coverage_lock);
+}
+
+void render_coverage_end(struct render * render) {
+    SDL_AtomicLock(&render->coverage_lock);
+    render->coverage_dirty = true;
+    render->points_gen++;
+    SDL_AtomicUnlock(&render->coverage_lock);
+}
+
+// Rebuild the lookup & sample textures if the output devices changed
+static void render_sample_update(struct render * render) {
+    GLenum e;
+
+    SDL_AtomicLock(&render->coverage_lock);
+    if(render->coords_gen == render->points_gen) {
+        SDL_AtomicUnlock(&render->coverage_lock);
+        return;
+    }
+    render->coords_gen = render->points_gen;
+    size_t n = render->n_points;
+    int width = MIN(n, RENDER_SAMPLE_WIDTH);
+    int height = (n + RENDER_SAMPLE_WIDTH - 1) / RENDER_SAMPLE_WIDTH;
+    GLfloat * coords = calloc(MAX(width * height, 1), 4 * sizeof *coords);
+    if(coords == NULL) MEMFAIL();
+    for(size_t i = 0; i < n; i++) {
+        coords[4 * i] = render->points[2 * i];
+        coords[4 * i + 1] = render->points[2 * i + 1];
+    }
+    SDL_AtomicUnlock(&render->coverage_lock);
+
+    if(render->sample_tex != 0) texpool_put(render->sample_tex);
+    render->sample_tex = 0;
+    render->n_samples = n;
+    render->sample_width = width;
+    render->sample_height = height;
+    if(n == 0) {
+        free(coords);
+        return;
+    }
+
+    if(render->coords_tex == 0) {
+        glGenTextures(1, &render->coords_tex);
+        glBindTexture(GL_TEXTURE_2D, render->coords_tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, render->coords_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, coords);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    free(coords);
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+
+    render->sample_tex = texpool_get(width, height);
+    DEBUG("LED-only rendering: %zu points in a %dx%d texture", n, width, height);
+}
+
+bool render_sample_begin(struct render * render) {
+    render_sample_update(render);
+    if(render->n_samples == 0) return false;
+
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, texpool_framebuffer());
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, render->sample_tex, 0);
+    glViewport(0, 0, render->sample_width, render->sample_height);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, render->coords_tex);
+    return true;
+}
+
+bool render_sample_points(struct render * render, size_t offset, size_t n, SDL_Color * colors) {
+    SDL_AtomicLock(&render->coverage_lock);
+    unsigned int gen = render->points_gen;
+    SDL_AtomicUnlock(&render->coverage_lock);
+
+    // The samples must come from the current set of points
+    if(render->samples == NULL || render->samples_gen != gen || offset + n > render->n_samples_read)
+        return false;
+    memcpy(colors, &render->samples[BYTES_PER_PIXEL * offset], n * sizeof *colors);
+    return true;
+}
+
+bool render_has_canvas(const struct render * render) {
+    // The software crossfader always writes the whole canvas
+    return soft_enabled || !config.pattern.led_only;
+}
+
+static void render_coverage_update(struct render * render) {
+    SDL_AtomicLock(&render->coverage_lock);
+    if(!render->coverage_dirty) {
+        SDL_AtomicUnlock(&render->coverage_lock);
+        return;
+    }
+    render->coverage_dirty = false;
+
+    free(render->spans);
+    render->spans = NULL;
+    render->n_spans = 0;
+    // At most one run per two tiles in a row
+    size_t max_spans = render->tiles_h * ((render->tiles_w + 1) / 2);
+    render->spans = malloc(max_spans * 4 * sizeof *render->spans);
+    if(render->spans == NULL) MEMFAIL();
+
+    // Tile edges in clip space; the last tile may be partial
+    float tile_x = 2. * RENDER_TILE_SIZE / config.pattern.master_width;
+    float tile_y = 2. * RENDER_TILE_SIZE / config.pattern.master_height;
+    for(int r = 0; r < render->tiles_h; r++) {
+        const uint8_t * row = &render->coverage[r * render->tiles_w];
+        for(int c = 0; c < render->tiles_w; ) {
+            if(!row[c]) {
+                c++;
+                continue;
+            }
+            int start = c;
+            while(c < render->tiles_w && row[c]) c++;
+            GLfloat * span = &render->spans[4 * render->n_spans++];
+            span[0] = -1. + start * tile_x;
+            span[1] = -1. + r * tile_y;
+            span[2] = MIN(-1. + c * tile_x, 1.);
+            span[3] = MIN(-1. + (r + 1) * tile_y, 1.);
+        }
+    }
+    SDL_AtomicUnlock(&render->coverage_lock);
+
+    DEBUG("Sparse rendering: %d runs covering output devices", render->n_spans);
+}
+
+void render_draw(struct render * render, bool sparse) {
+    if(sparse) render_coverage_update(render);
+
+    glBegin(GL_QUADS);
+    if(!sparse || render->spans == NULL) {
+        glVertex2d(-1, -1);
+        glVertex2d(-1, 1);
+        glVertex2d(1, 1);
+        glVertex2d(1, -1);
+    } else {
+        for(int i = 0; i < render->n_spans; i++) {
+            const GLfloat * span = &render->spans[4 * i];
+            glVertex2f(span[0], span[1]);
+            glVertex2f(span[0], span[3]);
+            glVertex2f(span[2], span[3]);
+            glVertex2f(span[2], span[1]);
+        }
+    }
+    glEnd();
+}
@@ -3,13 +3,49 @@
 #define GL_GLEXT_PROTOTYPES
 #include <SDL2/SDL_opengl.h>
 #include "util/opengl.h"
+#include <stdbool.h>
 #include <stdint.h>
 #include <SDL2/SDL.h>
 
+// Canvas tiles (in master-size pixels) for sparse rendering
+#define RENDER_TILE_SIZE 8
+
+// Row length of the sample texture used with `[pattern] led_only`
+#define RENDER_SAMPLE_WIDTH 1024
+
 struct render {
     GLuint fb;
     uint8_t * pixels;
     SDL_mutex * mutex;
+
+    // Tiles that some output device samples, written by the output thread
+    int tiles_w;
+    int tiles_h;
+    uint8_t * coverage;
+    bool coverage_dirty;
+    SDL_SpinLock coverage_lock;
+    // Covered tiles merged into horizontal runs, as quads in clip space; owned by the render thread
+    GLfloat * spans;
+    int n_spans;
+
+    // With `[pattern] led_only`, the canvas coordinates of every sampled point, in the order
+    // they were passed to render_coverage_add; written by the output thread under `coverage_lock`
+    GLfloat * points;
+    size_t n_points;
+    size_t points_size;
+    unsigned int points_gen;
+    // The points as a lookup texture, and a texture with one texel per point; owned by the render thread
+    GLuint coords_tex;
+    GLuint sample_tex;
+    int sample_width;
+    int sample_height;
+    size_t n_samples;
+    unsigned int coords_gen;
+    // The sample texture, read back under `mutex`
+    uint8_t * samples;
+    size_t samples_size;
+    size_t n_samples_read;
+    unsigned int samples_gen;
 };
 
 void render_init(struct render * render, GLint texture);
@@ -19,3 +55,22 @@ void render_term(struct render * render);
 void render_freeze(struct render * render);
 void render_thaw(struct render * render);
 SDL_Color render_sample(struct render * render, float x, float y);
+
+// Coverage: the output thread marks each point it samples (in the same coordinates as
+// render_sample) between render_coverage_begin and render_coverage_end
+void render_coverage_begin(struct render * render);
+void render_coverage_add(struct render * render, float x, float y);
+void render_coverage_end(struct render * render);
+
+// With `[pattern] led_only`, point the shared framebuffer and viewport at the sample texture,
+// and bind the coordinate lookup texture to GL_TEXTURE2. Returns false if there are no points yet.
+bool render_sample_begin(struct render * render);
+// Copy the sampled colors of points [offset, offset + n); returns false if they weren't sampled
+// (e.g. the points changed since the last readback). Call between render_freeze and render_thaw.
+bool render_sample_points(struct render * render, size_t offset, size_t n, SDL_Color * colors);
+// False with `[pattern] led_only`, where `pixels` isn't read back, so render_sample can't stand in
+// for render_sample_points
+bool render_has_canvas(const struct render * render);
+
+// Draw a full-canvas quad, or with `sparse`, only the covered tiles (plus `[pattern] sparse_margin`)
+void render_draw(struct render * render, bool sparse);
@@ -5,14 +5,20 @@
 #include <SDL2/SDL_opengl.h>
 #include <SDL2/SDL_ttf.h>
 #include "pattern/pattern.h"
+#include "pattern/loader.h"
+#include "pattern/index.h"
+#include "pattern/soft.h"
 #include "util/config.h"
 #include "util/err.h"
 #include "util/glsl.h"
 #include "util/math.h"
+#include "util/profile.h"
 #include "midi/midi.h"
 #include "output/output.h"
 #include "audio/analyze.h"
 #include "ui/render.h"
+#include "ui/offscreen.h"
+#include "ui/control.h"
 #include "output/slice.h"
 #include "main.h"
 #include <stdio.h>
@@ -23,6 +29,7 @@ static SDL_Window * window;
 static SDL_GLContext context;
 static SDL_Renderer * renderer;
 static bool quit;
+static bool headless;
 static GLhandleARB main_shader;
 static GLhandleARB pat_shader;
 static GLhandleARB blit_shader;
@@ -32,6 +39,18 @@ static GLhandleARB spectrum_shader;
 static GLhandleARB waveform_shader;
 static GLhandleARB strip_shader;
 
+// Uniform locations, looked up once in ui_init
+static struct {
+    struct { GLint resolution, text_resolution, text; } text;
+    struct { GLint position, resolution, texture; } blit;
+    struct { GLint preview, resolution, indicator; } strip;
+    struct { GLint resolution, selection, preview, name, pattern_index, intensity, name_resolution; } pat;
+    struct { GLint resolution, selection, preview, strips, intensity, indicator; } crossfader;
+    struct { GLint resolution, bins, spectrum; } spectrum;
+    struct { GLint resolution, length, waveform, beats; } waveform;
+    struct { GLint resolution, selection, selected, left_deck_selector, right_deck_selector; } main;
+} uni;
+
 static GLuint pat_fb;
 static GLuint select_fb;
 static GLuint crossfader_fb;
@@ -113,6 +132,15 @@ static int snap_states[19];
 TTF_Font * font;
 static const SDL_Color font_color = {255, 255, 255, 255};
 
+// Profiler overlay, toggled with `p`; redrawn a few times a second
+#define PROFILE_OVERLAY_LINES 32
+static bool profile_overlay;
+static SDL_Texture * profile_lines[PROFILE_OVERLAY_LINES];
+static int profile_line_width[PROFILE_OVERLAY_LINES];
+static int profile_line_height[PROFILE_OVERLAY_LINES];
+static int n_profile_lines;
+static unsigned int profile_overlay_frame;
+
 // Pat entry
 static bool pat_entry;
 static char pat_entry_text[255];
@@ -156,22 +184,37 @@ static SDL_Texture * render_text(char * text, int * w, int * h) {
     return texture;
 }
 
-static void render_textbox(char * text, int width, int height) {
-    GLint location;
+static void profile_overlay_update() {
+    for(int i = 0; i < n_profile_lines; i++) {
+        SDL_DestroyTexture(profile_lines[i]);
+    }
+    n_profile_lines = 0;
+    if(!profile_overlay) return;
+
+    struct profile_stat stats[PROFILE_OVERLAY_LINES - 1];
+    int n = profile_stats(stats, PROFILE_OVERLAY_LINES - 1);
+    char line[128];
+    snprintf(line, sizeof line, "Frame time, ms (p50 / p99)");
+    profile_lines[n_profile_lines++] = render_text(line, &profile_line_width[0], &profile_line_height[0]);
+    for(int i = 0; i < n; i++) {
+        snprintf(line, sizeof line, "%s %.*s: %.2f / %.2f", stats[i].gpu ? "GPU" : "CPU",
+                 PROFILE_NAME_SIZE, stats[i].name, stats[i].p50, stats[i].p99);
+        int k = n_profile_lines++;
+        profile_lines[k] = render_text(line, &profile_line_width[k], &profile_line_height[k]);
+    }
+}
 
+static void render_textbox(char * text, int width, int height) {
     glUseProgramObjectARB(text_shader);
-    location = glGetUniformLocationARB(text_shader, "iResolution");
-    glUniform2fARB(location, width, height);
+    glUniform2fARB(uni.text.resolution, width, height);
 
     int text_w;
     int text_h;
 
     SDL_Texture * tex = render_text(text, &text_w, &text_h);
 
-    location = glGetUniformLocationARB(text_shader, "iTextResolution");
-    glUniform2fARB(location, text_w, text_h);
-    location = glGetUniformLocationARB(text_shader, "iText");
-    glUniform1iARB(location, 0);
+    glUniform2fARB(uni.text.text_resolution, text_w, text_h);
+    glUniform1iARB(uni.text.text, 0);
     glActiveTexture(GL_TEXTURE0);
     SDL_GL_BindTexture(tex, NULL, NULL);
 
@@ -183,24 +226,35 @@ static void render_textbox(char * text, int width, int height) {
     SDL_DestroyTexture(tex);
 }
 
-void ui_init() {
-    // Init SDL
-    if(SDL_Init(SDL_INIT_VIDEO) < 0) FAIL("SDL could not initialize! SDL Error: %s\n", SDL_GetError());
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 1);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
-
-    ww = config.ui.window_width;
-    wh = config.ui.window_height;
-
-    window = SDL_CreateWindow("Radiance", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, ww, wh, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
-    if(window == NULL) FAIL("Window could not be created: %s\n", SDL_GetError());
-    context = SDL_GL_CreateContext(window);
-    if(context == NULL) FAIL("OpenGL context could not be created: %s\n", SDL_GetError());
-    if(SDL_GL_SetSwapInterval(1) < 0) fprintf(stderr, "Warning: Unable to set VSync: %s\n", SDL_GetError());
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    if(renderer == NULL) FAIL("Could not create renderer: %s\n", SDL_GetError());
-    if(TTF_Init() < 0) FAIL("Could not initialize font library: %s\n", TTF_GetError());
+void ui_init(bool headless_mode) {
+    headless = headless_mode;
+    profile_overlay = !headless && profile_enabled && config.profile.overlay;
+
+    if(headless) {
+        // MIDI commands and SIGINT still arrive as SDL events
+        if(SDL_Init(SDL_INIT_EVENTS | SDL_INIT_TIMER) < 0) FAIL("SDL could not initialize! SDL Error: %s\n", SDL_GetError());
+        // The software renderer doesn't use OpenGL at all
+        if(soft_enabled) return;
+        offscreen_init();
+    } else {
+        // Init SDL
+        if(SDL_Init(SDL_INIT_VIDEO) < 0) FAIL("SDL could not initialize! SDL Error: %s\n", SDL_GetError());
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 1);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
+
+        ww = config.ui.window_width;
+        wh = config.ui.window_height;
+
+        window = SDL_CreateWindow("Radiance", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, ww, wh, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
+        if(window == NULL) FAIL("Window could not be created: %s\n", SDL_GetError());
+        context = SDL_GL_CreateContext(window);
+        if(context == NULL) FAIL("OpenGL context could not be created: %s\n", SDL_GetError());
+        if(SDL_GL_SetSwapInterval(1) < 0) fprintf(stderr, "Warning: Unable to set VSync: %s\n", SDL_GetError());
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+        if(renderer == NULL) FAIL("Could not create renderer: %s\n", SDL_GetError());
+        if(TTF_Init() < 0) FAIL("Could not initialize font library: %s\n", TTF_GetError());
+    }
 
     // Init OpenGL
     GLenum e;
@@ -224,6 +278,9 @@ void ui_init() {
         FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
     }
 
+    // Headless, only the decks & crossfader are drawn; none of the UI elements are needed
+    if(headless) return;
+
     // Make framebuffers
     glGenFramebuffersEXT(1, &select_fb);
     glGenFramebuffersEXT(1, &pat_fb);
@@ -360,6 +417,42 @@ void ui_init() {
     if((waveform_shader = load_shader("resources/ui_waveform.glsl")) == 0) FAIL("Could not load UI waveform shader!\n%s", load_shader_error);
     if((strip_shader = load_shader("resources/strip.glsl")) == 0) FAIL("Could not load strip indicator shader!\n%s", load_shader_error);
 
+    // Look up uniforms
+    uni.text.resolution = glGetUniformLocationARB(text_shader, "iResolution");
+    uni.text.text_resolution = glGetUniformLocationARB(text_shader, "iTextResolution");
+    uni.text.text = glGetUniformLocationARB(text_shader, "iText");
+    uni.blit.position = glGetUniformLocationARB(blit_shader, "iPosition");
+    uni.blit.resolution = glGetUniformLocationARB(blit_shader, "iResolution");
+    uni.blit.texture = glGetUniformLocationARB(blit_shader, "iTexture");
+    uni.strip.preview = glGetUniformLocationARB(strip_shader, "iPreview");
+    uni.strip.resolution = glGetUniformLocationARB(strip_shader, "iResolution");
+    uni.strip.indicator = glGetUniformLocationARB(strip_shader, "iIndicator");
+    uni.pat.resolution = glGetUniformLocationARB(pat_shader, "iResolution");
+    uni.pat.selection = glGetUniformLocationARB(pat_shader, "iSelection");
+    uni.pat.preview = glGetUniformLocationARB(pat_shader, "iPreview");
+    uni.pat.name = glGetUniformLocationARB(pat_shader, "iName");
+    uni.pat.pattern_index = glGetUniformLocationARB(pat_shader, "iPatternIndex");
+    uni.pat.intensity = glGetUniformLocationARB(pat_shader, "iIntensity");
+    uni.pat.name_resolution = glGetUniformLocationARB(pat_shader, "iNameResolution");
+    uni.crossfader.resolution = glGetUniformLocationARB(crossfader_shader, "iResolution");
+    uni.crossfader.selection = glGetUniformLocationARB(crossfader_shader, "iSelection");
+    uni.crossfader.preview = glGetUniformLocationARB(crossfader_shader, "iPreview");
+    uni.crossfader.strips = glGetUniformLocationARB(crossfader_shader, "iStrips");
+    uni.crossfader.intensity = glGetUniformLocationARB(crossfader_shader, "iIntensity");
+    uni.crossfader.indicator = glGetUniformLocationARB(crossfader_shader, "iIndicator");
+    uni.spectrum.resolution = glGetUniformLocationARB(spectrum_shader, "iResolution");
+    uni.spectrum.bins = glGetUniformLocationARB(spectrum_shader, "iBins");
+    uni.spectrum.spectrum = glGetUniformLocationARB(spectrum_shader, "iSpectrum");
+    uni.waveform.resolution = glGetUniformLocationARB(waveform_shader, "iResolution");
+    uni.waveform.length = glGetUniformLocationARB(waveform_shader, "iLength");
+    uni.waveform.waveform = glGetUniformLocationARB(waveform_shader, "iWaveform");
+    uni.waveform.beats = glGetUniformLocationARB(waveform_shader, "iBeats");
+    uni.main.resolution = glGetUniformLocationARB(main_shader, "iResolution");
+    uni.main.selection = glGetUniformLocationARB(main_shader, "iSelection");
+    uni.main.selected = glGetUniformLocationARB(main_shader, "iSelected");
+    uni.main.left_deck_selector = glGetUniformLocationARB(main_shader, "iLeftDeckSelector");
+    uni.main.right_deck_selector = glGetUniformLocationARB(main_shader, "iRightDeckSelector");
+
     // Stop text input
     SDL_StopTextInput();
 
@@ -380,6 +473,11 @@ void ui_init() {
 }
 
 void ui_term() {
+    profile_overlay = false;
+    if(!headless) profile_overlay_update();
+
+    if(headless) return;
+
     TTF_CloseFont(font);
     for(int i=0; i<config.ui.n_patterns; i++) {
         if(pattern_name_textures[i] != NULL) SDL_DestroyTexture(pattern_name_textures[i]);
@@ -389,19 +487,52 @@ void ui_term() {
     free(pattern_name_width);
     free(pattern_name_height);
     // TODO glDeleteTextures...
-    glDeleteObjectARB(blit_shader);
-    glDeleteObjectARB(main_shader);
-    glDeleteObjectARB(pat_shader);
-    glDeleteObjectARB(crossfader_shader);
-    glDeleteObjectARB(text_shader);
-    glDeleteObjectARB(spectrum_shader);
-    glDeleteObjectARB(waveform_shader);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    window = NULL;
+    unload_shader(blit_shader);
+    unload_shader(main_shader);
+    unload_shader(pat_shader);
+    unload_shader(crossfader_shader);
+    unload_shader(text_shader);
+    unload_shader(spectrum_shader);
+    unload_shader(waveform_shader);
+}
+
+void ui_context_term() {
+    if(headless) {
+        if(!soft_enabled) offscreen_term();
+    } else {
+        SDL_DestroyRenderer(renderer);
+        SDL_GL_DeleteContext(context);
+        SDL_DestroyWindow(window);
+        window = NULL;
+    }
     SDL_Quit();
 }
 
+void * ui_shared_context_create() {
+    if(headless) return offscreen_shared_context_create();
+
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+    SDL_GLContext shared = SDL_GL_CreateContext(window);
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+    if(shared == NULL) WARN("Could not create shared OpenGL context: %s", SDL_GetError());
+    // Creating a context makes it current
+    SDL_GL_MakeCurrent(window, context);
+    return shared;
+}
+
+int ui_shared_context_bind(void * shared) {
+    if(headless) return offscreen_shared_context_bind(shared);
+    return SDL_GL_MakeCurrent(shared != NULL ? window : NULL, shared);
+}
+
+void ui_shared_context_destroy(void * shared) {
+    if(headless) {
+        offscreen_shared_context_destroy(shared);
+        return;
+    }
+    if(shared != NULL) SDL_GL_DeleteContext(shared);
+}
+
 static struct pattern * selected_pattern(int s) {
     for(int i=0; i<config.ui.n_patterns; i++) {
         if(map_selection[i] == s) return deck[map_deck[i]].pattern[map_pattern[i]];
@@ -445,12 +576,69 @@ static void increment_slider(int s, float v) {
 static void redraw_pattern_ui(int s) {
     snap_states[s] = 0;
     const struct pattern * p = deck[map_deck[s]].pattern[map_pattern[s]];
-    if (p == NULL) return;
+    if (p == NULL || headless) return;
     
     if(pattern_name_textures[s] != NULL) SDL_DestroyTexture(pattern_name_textures[s]);
     pattern_name_textures[s] = render_text(p->name, &pattern_name_width[s], &pattern_name_height[s]);
 }
 
+static void redraw_deck_ui(int d) {
+    for(int i = 0; i < config.ui.n_patterns; i++) {
+        if(map_deck[i] == d) redraw_pattern_ui(i);
+    }
+}
+
+static void handle_loaded(struct deck * d, int slot) {
+    redraw_deck_ui(d - deck);
+}
+
+static void handle_changed(const char * name) {
+    for(int i = 0; i < N_DECKS; i++) {
+        deck_refresh(&deck[i], name);
+    }
+}
+
+static int handle_control(const struct control_command * c) {
+    struct pattern * p;
+    switch(c->type) {
+        case CONTROL_LOAD:
+            if(deck_load_pattern(&deck[c->deck], c->slot, c->name, c->value) != 0) return -1;
+            redraw_deck_ui(c->deck);
+            return 0;
+        case CONTROL_UNLOAD:
+            deck_unload_pattern(&deck[c->deck], c->slot);
+            return 0;
+        case CONTROL_INTENSITY:
+            p = deck[c->deck].pattern[c->slot];
+            if(p == NULL) return -1;
+            p->intensity = CLAMP(c->value, 0., 1.);
+            return 0;
+        case CONTROL_CROSSFADER:
+            crossfader.position = CLAMP(c->value, 0., 1.);
+            return 0;
+        case CONTROL_SELECT:
+            left_deck_selector = c->deck;
+            right_deck_selector = c->slot;
+            return 0;
+        case CONTROL_DECK_LOAD:
+            if(deck_load_set(&deck[c->deck], c->name) != 0) return -1;
+            redraw_deck_ui(c->deck);
+            return 0;
+        case CONTROL_DECK_SAVE:
+            return deck_save(&deck[c->deck], c->name) < 0 ? -1 : 0;
+        case CONTROL_RELOAD:
+            params_refresh();
+            if(c->slot) {
+                midi_refresh();
+                output_refresh();
+            }
+            return 0;
+        case CONTROL_PROFILE:
+            return profile_dump(c->name);
+    }
+    return -1;
+}
+
 static void handle_key(SDL_KeyboardEvent * e) {
     // See SDLKey man page
     bool shift = e->keysym.mod & KMOD_SHIFT;
@@ -491,6 +679,11 @@ static void handle_key(SDL_KeyboardEvent * e) {
                     handle_text("\0");
                 }
                 break;
+            case SDLK_TAB:
+                if (pattern_index_complete(pat_entry_text, sizeof pat_entry_text) == 0)
+                    DEBUG("No pattern matches '%s'", pat_entry_text);
+                handle_text("\0");
+                break;
             default:
                 break;
         }
@@ -568,7 +761,7 @@ static void handle_key(SDL_KeyboardEvent * e) {
             case SDLK_0:
                 set_slider_to(selected, 1, 0);
                 break;
-            case SDLK_SEMICOLON: if(!shift) break;
+            case SDLK_SEMICOLON: if(!shift || headless) break;
                 for(int i=0; i<config.ui.n_patterns; i++) {
                     if(map_selection[i] == selected) {
                         pat_entry = true;
@@ -640,6 +833,10 @@ static void handle_key(SDL_KeyboardEvent * e) {
                     }
                 }
                 break;
+            case SDLK_p:
+                profile_overlay = profile_enabled && !profile_overlay;
+                profile_overlay_update();
+                break;
             case SDLK_q:
                 switch(strip_indicator) {
                     case STRIPS_NONE:
@@ -661,11 +858,8 @@ static void handle_key(SDL_KeyboardEvent * e) {
 }
 
 static void blit(float x, float y, float w, float h) {
-    GLint location;
-    location = glGetUniformLocationARB(blit_shader, "iPosition");
-    glUniform2fARB(location, x, y);
-    location = glGetUniformLocationARB(blit_shader, "iResolution");
-    glUniform2fARB(location, w, h);
+    glUniform2fARB(uni.blit.position, x, y);
+    glUniform2fARB(uni.blit.resolution, w, h);
 
     glBegin(GL_QUADS);
     glVertex2f(x, y);
@@ -676,7 +870,6 @@ static void blit(float x, float y, float w, float h) {
 }
 
 static void ui_render(bool select) {
-    GLint location;
     GLenum e;
 
     // Render strip indicators
@@ -688,12 +881,9 @@ static void ui_render(bool select) {
             glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, strip_fb);
             glUseProgramObjectARB(strip_shader);
 
-            location = glGetUniformLocationARB(strip_shader, "iPreview");
-            glUniform1iARB(location, 0);
-            location = glGetUniformLocationARB(strip_shader, "iResolution");
-            glUniform2fARB(location, config.pattern.master_width, config.pattern.master_height);
-            location = glGetUniformLocationARB(strip_shader, "iIndicator");
-            glUniform1iARB(location, strip_indicator);
+            glUniform1iARB(uni.strip.preview, 0);
+            glUniform2fARB(uni.strip.resolution, config.pattern.master_width, config.pattern.master_height);
+            glUniform1iARB(uni.strip.indicator, strip_indicator);
 
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, crossfader.tex_output);
@@ -750,18 +940,11 @@ static void ui_render(bool select) {
     int pw = config.ui.pattern_width;
     int ph = config.ui.pattern_height;
     glUseProgramObjectARB(pat_shader);
-    location = glGetUniformLocationARB(pat_shader, "iResolution");
-    glUniform2fARB(location, pw, ph);
+    glUniform2fARB(uni.pat.resolution, pw, ph);
     glUseProgramObjectARB(pat_shader);
-    location = glGetUniformLocationARB(pat_shader, "iSelection");
-    glUniform1iARB(location, select);
-    location = glGetUniformLocationARB(pat_shader, "iPreview");
-    glUniform1iARB(location, 0);
-    location = glGetUniformLocationARB(pat_shader, "iName");
-    glUniform1iARB(location, 1);
-    GLint pattern_index = glGetUniformLocationARB(pat_shader, "iPatternIndex");
-    GLint pattern_intensity = glGetUniformLocationARB(pat_shader, "iIntensity");
-    GLint name_resolution = glGetUniformLocationARB(pat_shader, "iNameResolution");
+    glUniform1iARB(uni.pat.selection, select);
+    glUniform1iARB(uni.pat.preview, 0);
+    glUniform1iARB(uni.pat.name, 1);
 
     glLoadIdentity();
     gluOrtho2D(0, pw, 0, ph);
@@ -774,9 +957,9 @@ static void ui_render(bool select) {
             glBindTexture(GL_TEXTURE_2D, p->tex_output);
             glActiveTexture(GL_TEXTURE1);
             SDL_GL_BindTexture(pattern_name_textures[i], NULL, NULL);
-            glUniform1iARB(pattern_index, i);
-            glUniform1fARB(pattern_intensity, p->intensity);
-            glUniform2fARB(name_resolution, pattern_name_width[i], pattern_name_height[i]);
+            glUniform1iARB(uni.pat.pattern_index, i);
+            glUniform1fARB(uni.pat.intensity, p->intensity);
+            glUniform2fARB(uni.pat.name_resolution, pattern_name_width[i], pattern_name_height[i]);
             glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, pattern_textures[i], 0);
             glClear(GL_COLOR_BUFFER_BIT);
             fill(pw, ph);
@@ -789,18 +972,12 @@ static void ui_render(bool select) {
     int cw = config.ui.crossfader_width;
     int ch = config.ui.crossfader_height;
     glUseProgramObjectARB(crossfader_shader);
-    location = glGetUniformLocationARB(crossfader_shader, "iResolution");
-    glUniform2fARB(location, cw, ch);
-    location = glGetUniformLocationARB(crossfader_shader, "iSelection");
-    glUniform1iARB(location, select);
-    location = glGetUniformLocationARB(crossfader_shader, "iPreview");
-    glUniform1iARB(location, 0);
-    location = glGetUniformLocationARB(crossfader_shader, "iStrips");
-    glUniform1iARB(location, 1);
-    location = glGetUniformLocationARB(crossfader_shader, "iIntensity");
-    glUniform1fARB(location, crossfader.position);
-    location = glGetUniformLocationARB(crossfader_shader, "iIndicator");
-    glUniform1iARB(location, strip_indicator);
+    glUniform2fARB(uni.crossfader.resolution, cw, ch);
+    glUniform1iARB(uni.crossfader.selection, select);
+    glUniform1iARB(uni.crossfader.preview, 0);
+    glUniform1iARB(uni.crossfader.strips, 1);
+    glUniform1fARB(uni.crossfader.intensity, crossfader.position);
+    glUniform1iARB(uni.crossfader.indicator, strip_indicator);
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, crossfader.tex_output);
@@ -827,12 +1004,9 @@ static void ui_render(bool select) {
         sw = config.ui.spectrum_width;
         sh = config.ui.spectrum_height;
         glUseProgramObjectARB(spectrum_shader);
-        location = glGetUniformLocationARB(spectrum_shader, "iResolution");
-        glUniform2fARB(location, sw, sh);
-        location = glGetUniformLocationARB(spectrum_shader, "iBins");
-        glUniform1iARB(location, config.audio.spectrum_bins);
-        location = glGetUniformLocationARB(spectrum_shader, "iSpectrum");
-        glUniform1iARB(location, 0);
+        glUniform2fARB(uni.spectrum.resolution, sw, sh);
+        glUniform1iARB(uni.spectrum.bins, config.audio.spectrum_bins);
+        glUniform1iARB(uni.spectrum.spectrum, 0);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_1D, tex_spectrum_data);
 
@@ -848,14 +1022,10 @@ static void ui_render(bool select) {
         vw = config.ui.waveform_width;
         vh = config.ui.waveform_height;
         glUseProgramObjectARB(waveform_shader);
-        location = glGetUniformLocationARB(waveform_shader, "iResolution");
-        glUniform2fARB(location, sw, sh);
-        location = glGetUniformLocationARB(waveform_shader, "iLength");
-        glUniform1iARB(location, config.audio.waveform_length);
-        location = glGetUniformLocationARB(waveform_shader, "iWaveform");
-        glUniform1iARB(location, 0);
-        location = glGetUniformLocationARB(waveform_shader, "iBeats");
-        glUniform1iARB(location, 1);
+        glUniform2fARB(uni.waveform.resolution, sw, sh);
+        glUniform1iARB(uni.waveform.length, config.audio.waveform_length);
+        glUniform1iARB(uni.waveform.waveform, 0);
+        glUniform1iARB(uni.waveform.beats, 1);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_1D, tex_waveform_data);
         glActiveTexture(GL_TEXTURE1);
@@ -883,16 +1053,11 @@ static void ui_render(bool select) {
 
     glUseProgramObjectARB(main_shader);
 
-    location = glGetUniformLocationARB(main_shader, "iResolution");
-    glUniform2fARB(location, ww, wh);
-    location = glGetUniformLocationARB(main_shader, "iSelection");
-    glUniform1iARB(location, select);
-    location = glGetUniformLocationARB(main_shader, "iSelected");
-    glUniform1iARB(location, selected);
-    location = glGetUniformLocationARB(main_shader, "iLeftDeckSelector");
-    glUniform1iARB(location, left_deck_selector);
-    location = glGetUniformLocationARB(main_shader, "iRightDeckSelector");
-    glUniform1iARB(location, right_deck_selector);
+    glUniform2fARB(uni.main.resolution, ww, wh);
+    glUniform1iARB(uni.main.selection, select);
+    glUniform1iARB(uni.main.selected, selected);
+    glUniform1iARB(uni.main.left_deck_selector, left_deck_selector);
+    glUniform1iARB(uni.main.right_deck_selector, right_deck_selector);
 
     fill(ww, wh);
 
@@ -900,8 +1065,7 @@ static void ui_render(bool select) {
     glEnable(GL_BLEND);
     glUseProgramObjectARB(blit_shader);
     glActiveTexture(GL_TEXTURE0);
-    location = glGetUniformLocationARB(blit_shader, "iTexture");
-    glUniform1iARB(location, 0);
+    glUniform1iARB(uni.blit.texture, 0);
 
     for(int i = 0; i < config.ui.n_patterns; i++) {
         struct pattern * pattern = deck[map_deck[i]].pattern[map_pattern[i]];
@@ -930,6 +1094,15 @@ static void ui_render(bool select) {
                 }
             }
         }
+
+        // Top-left, one line under the other
+        int y = wh;
+        for(int i = 0; i < n_profile_lines; i++) {
+            y -= profile_line_height[i];
+            SDL_GL_BindTexture(profile_lines[i], NULL, NULL);
+            // Text surfaces are stored top row first, so flip it
+            blit(10, y + profile_line_height[i], profile_line_width[i], -profile_line_height[i]);
+        }
     }
 
     glDisable(GL_BLEND);
@@ -1028,7 +1201,13 @@ void ui_run() {
 
         quit = false;
         while(!quit) {
-            ui_render(true);
+            double frame_start = SDL_GetTicks();
+            struct profile_mark mark;
+            if(!headless) {
+                mark = profile_begin();
+                ui_render(true);
+                profile_end(mark, "ui select");
+            }
 
             while(SDL_PollEvent(&e) != 0) {
                 if (midi_command_event != (Uint32) -1 && 
@@ -1087,15 +1266,54 @@ void ui_run() {
                 }
             }
 
+            struct control_command * c;
+            while((c = control_poll()) != NULL) {
+                control_done(c, handle_control(c));
+            }
+
+            // Recompile patterns edited on disk
+            pattern_index_refresh(&handle_changed);
+
+            // Patterns finished by the background loader go in between frames
+            loader_swap(&handle_loaded);
+
+            pattern_globals_update();
             for(int i=0; i<N_DECKS; i++) {
-                deck_render(&deck[i]);
+                // With the UI up, every deck is previewed
+                bool visible = !headless
+                    || (i == left_deck_selector && crossfader.position < 1.)
+                    || (i == right_deck_selector && crossfader.position > 0.);
+                mark = profile_begin();
+                deck_render(&deck[i], visible);
+                profile_end(mark, "deck %d", i);
+            }
+            deck_autoscale(deck, N_DECKS);
+            mark = profile_begin();
+            crossfader_render(&crossfader, &deck[left_deck_selector], &deck[right_deck_selector], !headless);
+            profile_end(mark, "crossfader");
+            if(!headless) {
+                mark = profile_begin();
+                ui_render(false);
+                profile_end(mark, "ui");
             }
-            crossfader_render(&crossfader, deck[left_deck_selector].tex_output, deck[right_deck_selector].tex_output);
-            ui_render(false);
 
+            mark = profile_begin();
             render_readback(&render);
+            profile_end(mark, "readback");
 
-            SDL_GL_SwapWindow(window);
+            profile_frame();
+            if(profile_overlay && ++profile_overlay_frame >= config.ui.fps / 4) {
+                profile_overlay_frame = 0;
+                profile_overlay_update();
+            }
+
+            if(headless) {
+                // No vsync to pace us, so hold the configured frame rate
+                double frame_ms = 1000. / config.ui.fps - (SDL_GetTicks() - frame_start);
+                if(frame_ms > 0) SDL_Delay(frame_ms);
+            } else {
+                SDL_GL_SwapWindow(window);
+            }
 
             double cur_t = SDL_GetTicks();
             double dt = cur_t - l_t;
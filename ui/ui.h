@@ -1,8 +1,18 @@
 #ifndef __UI_H
 #define __UI_H
 
-void ui_init();
+#include <stdbool.h>
+
+void ui_init(bool headless);
 void ui_run();
 void ui_term();
+// Destroys the OpenGL context; call once nothing else uses it
+void ui_context_term();
+
+// An OpenGL context sharing objects with the UI's, for use on another thread.
+// Create it on the UI thread, then bind it on the other thread (NULL to release it).
+void * ui_shared_context_create();
+int ui_shared_context_bind(void * shared);
+void ui_shared_context_destroy(void * shared);
 
 #endif
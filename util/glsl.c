@@ -1,14 +1,60 @@
 #include "util/glsl.h"
+#include "util/config.h"
 #include "util/err.h"
 
 #include "util/string.h"
+#include <SDL2/SDL.h>
 #include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 char * load_shader_error = 0;
 
+// Programs are shared between everything that loads the same source, and kept
+// around for a while after their last user unloads them so reloading is instant
+#define SHADER_CACHE_MAX_IDLE 64
+
+struct shader_cache_entry {
+    struct shader_cache_entry * next;
+    uint64_t hash;
+    GLhandleARB program;
+    int refs;
+    unsigned int last_used;
+};
+
+static struct shader_cache_entry * cache_head = NULL;
+static unsigned int cache_clock = 0;
+// Shaders are also loaded from the pattern loader thread
+static SDL_SpinLock cache_lock = 0;
+
+// Program binaries on disk, in `[pattern] shader_cache`
+#define SHADER_BINARY_MAGIC 0x42534452 // "RDSB"
+
+struct shader_binary_header {
+    uint32_t magic;
+    uint32_t format;
+    uint32_t length;
+};
+
+static int binary_supported = -1;
+static uint64_t binary_seed;
+// Held only while checking for support; that needs GL calls and a mkdir, so not under cache_lock
+static SDL_SpinLock binary_lock = 0;
+
+static uint64_t fnv1a(uint64_t hash, const char * data, size_t length) {
+    for(size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+#define FNV1A_INIT 0xcbf29ce484222325ull
+
 /*
 const char default_vertex_shader[] = "                          \n\
 #version 130                                                    \n\
@@ -61,21 +107,137 @@ static char * read_file(const char * filename, ssize_t * length) {
     return buffer;
 }
 
-GLhandleARB load_shader(const char * filename) {
-    // Load file
-    GLcharARB * buffer = NULL;
-    GLint length;
-    ssize_t prog_len = 0, head_len = 0;
-    char * prog_buffer = read_file(filename, &prog_len);
-    char * head_buffer = read_file("resources/header.glsl", &head_len);
-    if (prog_buffer != NULL || head_buffer != NULL) {
-        buffer = rsprintf("%s%s", head_buffer, prog_buffer);
+static bool binary_probe() {
+    if(config.pattern.shader_cache[0] == '\0') return false;
+    const char * extensions = (const char *) glGetString(GL_EXTENSIONS);
+    if(extensions == NULL || strstr(extensions, "GL_ARB_get_program_binary") == NULL) {
+        INFO("Program binaries not supported; not caching shaders on disk");
+        return false;
     }
-    free(prog_buffer);
-    free(head_buffer);
-    if (buffer == NULL) return 0;
-    length = strlen(buffer);
+    GLint n_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &n_formats);
+    if(n_formats <= 0) {
+        INFO("No program binary formats; not caching shaders on disk");
+        return false;
+    }
+    if(mkdir(config.pattern.shader_cache, 0755) < 0 && errno != EEXIST) {
+        WARN("Unable to create shader cache '%s': %s", config.pattern.shader_cache, strerror(errno));
+        return false;
+    }
+
+    // Binaries are only valid for the driver that made them
+    const char * vendor = (const char *) glGetString(GL_VENDOR);
+    const char * renderer = (const char *) glGetString(GL_RENDERER);
+    const char * version = (const char *) glGetString(GL_VERSION);
+    binary_seed = FNV1A_INIT;
+    if(vendor != NULL) binary_seed = fnv1a(binary_seed, vendor, strlen(vendor));
+    if(renderer != NULL) binary_seed = fnv1a(binary_seed, renderer, strlen(renderer));
+    if(version != NULL) binary_seed = fnv1a(binary_seed, version, strlen(version));
+    return true;
+}
+
+static bool binary_init() {
+    SDL_AtomicLock(&binary_lock);
+    if(binary_supported < 0) binary_supported = binary_probe();
+    bool supported = binary_supported;
+    SDL_AtomicUnlock(&binary_lock);
+    return supported;
+}
+
+static char * binary_path(const GLcharARB * buffer, GLint length) {
+    uint64_t key = fnv1a(binary_seed, buffer, length);
+    return rsprintf("%s/%016llx.bin", config.pattern.shader_cache, (unsigned long long) key);
+}
+
+static GLhandleARB binary_load(const GLcharARB * buffer, GLint length) {
+    if(!binary_init()) return 0;
+
+    char * path = binary_path(buffer, length);
+    if(path == NULL) MEMFAIL();
+    FILE * f = fopen(path, "rb");
+    if(f == NULL) {
+        free(path);
+        return 0;
+    }
+
+    GLhandleARB programObj = 0;
+    void * data = NULL;
+    struct shader_binary_header header;
+    struct stat st;
+    if(fread(&header, sizeof header, 1, f) != 1 || header.magic != SHADER_BINARY_MAGIC)
+        goto done;
+    // Don't trust the length in a truncated or foreign file
+    if(fstat(fileno(f), &st) < 0 || header.length == 0 || (uint64_t) st.st_size != sizeof header + (uint64_t) header.length) {
+        DEBUG("Stale shader binary %s", path);
+        goto done;
+    }
+    data = malloc(header.length);
+    if(data == NULL) MEMFAIL();
+    if(fread(data, 1, header.length, f) != header.length)
+        goto done;
+
+    programObj = glCreateProgramObjectARB();
+    GLuint program = (GLuint) programObj;
+    glProgramBinary(program, header.format, data, header.length);
+    GLint linked;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if(!linked) {
+        // e.g. after a driver update; it gets rewritten after compiling
+        DEBUG("Stale shader binary %s", path);
+        glDeleteObjectARB(programObj);
+        programObj = 0;
+    }
+
+done:
+    // Swallow any error from a rejected binary
+    glGetError();
+    fclose(f);
+    free(data);
+    free(path);
+    return programObj;
+}
 
+static void binary_save(const GLcharARB * buffer, GLint length, GLhandleARB programObj) {
+    if(!binary_init()) return;
+
+    GLuint program = (GLuint) programObj;
+    GLint binary_length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binary_length);
+    if(binary_length <= 0) return;
+
+    void * data = malloc(binary_length);
+    if(data == NULL) MEMFAIL();
+    GLenum format;
+    glGetProgramBinary(program, binary_length, NULL, &format, data);
+
+    struct shader_binary_header header = {
+        .magic = SHADER_BINARY_MAGIC,
+        .format = format,
+        .length = binary_length,
+    };
+    char * path = binary_path(buffer, length);
+    char * tmp_path = rsprintf("%s.tmp", path);
+    if(path == NULL || tmp_path == NULL) MEMFAIL();
+
+    // Write to a temporary file first so a concurrent load never sees half a binary
+    FILE * f = fopen(tmp_path, "wb");
+    if(f == NULL) {
+        WARN("Unable to write shader binary %s: %s", tmp_path, strerror(errno));
+    } else {
+        bool ok = fwrite(&header, sizeof header, 1, f) == 1
+               && fwrite(data, 1, binary_length, f) == (size_t) binary_length;
+        ok = (fclose(f) == 0) && ok;
+        if(!ok || rename(tmp_path, path) < 0) {
+            WARN("Unable to write shader binary %s", path);
+            unlink(tmp_path);
+        }
+    }
+    free(tmp_path);
+    free(path);
+    free(data);
+}
+
+static GLhandleARB compile_shader(GLcharARB * buffer, GLint length) {
     GLint compiled;
 
     // Compile
@@ -103,10 +265,8 @@ GLhandleARB load_shader(const char * filename) {
             load_shader_error = strdup("Shader compilation failed!");
         }
         glDeleteObjectARB(fragmentShaderObj);
-        free(buffer);
         return 0;
     }
-    free(buffer);
 
     /*
     length = sizeof(default_vertex_shader) - 1;
@@ -149,6 +309,8 @@ GLhandleARB load_shader(const char * filename) {
     GLuint program = (GLuint) programObj;
     //glAttachShader(programObj, vertexShaderObj);
     glAttachShader(program, fragmentShader);
+    if(binary_init())
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(program);
 
     GLint linked;
@@ -175,3 +337,94 @@ GLhandleARB load_shader(const char * filename) {
     glDeleteShader(fragmentShader);
     return programObj;
 }
+
+static void shader_cache_evict() {
+    int n_idle = 0;
+    for(struct shader_cache_entry * e = cache_head; e != NULL; e = e->next) {
+        if(e->refs == 0) n_idle++;
+    }
+
+    while(n_idle > SHADER_CACHE_MAX_IDLE) {
+        struct shader_cache_entry ** oldest = NULL;
+        for(struct shader_cache_entry ** e = &cache_head; *e != NULL; e = &(*e)->next) {
+            if((*e)->refs == 0 && (oldest == NULL || (*e)->last_used < (*oldest)->last_used))
+                oldest = e;
+        }
+        struct shader_cache_entry * victim = *oldest;
+        *oldest = victim->next;
+        glDeleteObjectARB(victim->program);
+        free(victim);
+        n_idle--;
+    }
+}
+
+GLhandleARB load_shader(const char * filename) {
+    ssize_t prog_len = 0;
+    char * prog_buffer = read_file(filename, &prog_len);
+    if (prog_buffer == NULL) return 0;
+    GLhandleARB program = load_shader_source(prog_buffer, filename);
+    free(prog_buffer);
+    return program;
+}
+
+GLhandleARB load_shader_source(const char * source, const char * filename) {
+    GLcharARB * buffer = NULL;
+    GLint length;
+    ssize_t head_len = 0;
+    char * head_buffer = read_file("resources/header.glsl", &head_len);
+    if (head_buffer != NULL) {
+        buffer = rsprintf("%s%s", head_buffer, source);
+    }
+    free(head_buffer);
+    if (buffer == NULL) return 0;
+    length = strlen(buffer);
+
+    uint64_t hash = fnv1a(FNV1A_INIT, buffer, length);
+    SDL_AtomicLock(&cache_lock);
+    for(struct shader_cache_entry * e = cache_head; e != NULL; e = e->next) {
+        if(e->hash == hash) {
+            e->refs++;
+            e->last_used = ++cache_clock;
+            SDL_AtomicUnlock(&cache_lock);
+            free(buffer);
+            return e->program;
+        }
+    }
+    SDL_AtomicUnlock(&cache_lock);
+
+    GLhandleARB program = binary_load(buffer, length);
+    if(program != 0) {
+        DEBUG("Loaded shader binary for %s", filename);
+    } else {
+        program = compile_shader(buffer, length);
+        if(program != 0) binary_save(buffer, length, program);
+    }
+    free(buffer);
+    if(program == 0) return 0;
+
+    struct shader_cache_entry * entry = calloc(1, sizeof *entry);
+    if(entry == NULL) MEMFAIL();
+    entry->hash = hash;
+    entry->program = program;
+    entry->refs = 1;
+    SDL_AtomicLock(&cache_lock);
+    entry->last_used = ++cache_clock;
+    entry->next = cache_head;
+    cache_head = entry;
+    SDL_AtomicUnlock(&cache_lock);
+    return program;
+}
+
+void unload_shader(GLhandleARB program) {
+    SDL_AtomicLock(&cache_lock);
+    for(struct shader_cache_entry * e = cache_head; e != NULL; e = e->next) {
+        if(e->program == program) {
+            if(e->refs > 0) e->refs--;
+            shader_cache_evict();
+            SDL_AtomicUnlock(&cache_lock);
+            return;
+        }
+    }
+    SDL_AtomicUnlock(&cache_lock);
+    glDeleteObjectARB(program);
+}
@@ -6,6 +6,10 @@
 
 extern char * load_shader_error;
 
+// Programs are cached by source; every load_shader must be paired with an unload_shader
 GLhandleARB load_shader(const char * filename);
+// Same, for source already in memory; `filename` is only used in messages
+GLhandleARB load_shader_source(const char * source, const char * filename);
+void unload_shader(GLhandleARB program);
 
 #endif
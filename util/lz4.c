@@ -0,0 +1,140 @@
+#include "util/lz4.h"
+
+#include <string.h>
+
+#define LZ4_HASH_BITS 12
+#define LZ4_MIN_MATCH 4
+#define LZ4_MAX_OFFSET 65535
+// The format requires the last 5 bytes to be literals, and the last match to start
+// at least 12 bytes before the end
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MF_LIMIT 12
+
+static inline uint32_t lz4_read32(const uint8_t * p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof x);
+    return x;
+}
+
+static inline uint32_t lz4_hash(uint32_t x) {
+    return (x * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+static uint8_t * lz4_put_length(uint8_t * op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = length;
+    return op;
+}
+
+static uint8_t * lz4_put_literals(uint8_t * op, uint8_t * token, const uint8_t * literals, size_t length) {
+    *token = (length < 15 ? length : 15) << 4;
+    if (length >= 15)
+        op = lz4_put_length(op, length - 15);
+    memcpy(op, literals, length);
+    return op + length;
+}
+
+size_t lz4_compress(const uint8_t * src, size_t length, uint8_t * dst) {
+    uint32_t table[1 << LZ4_HASH_BITS] = {0};
+    const uint8_t * ip = src;
+    const uint8_t * anchor = src;
+    const uint8_t * end = src + length;
+    uint8_t * op = dst;
+
+    if (length > LZ4_MF_LIMIT) {
+        const uint8_t * mf_limit = end - LZ4_MF_LIMIT;
+        const uint8_t * match_limit = end - LZ4_LAST_LITERALS;
+
+        while (ip < mf_limit) {
+            uint32_t seq = lz4_read32(ip);
+            uint32_t h = lz4_hash(seq);
+            const uint8_t * ref = src + table[h];
+            table[h] = ip - src;
+
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || lz4_read32(ref) != seq) {
+                ip++;
+                continue;
+            }
+
+            const uint8_t * match_end = ip + LZ4_MIN_MATCH;
+            ref += LZ4_MIN_MATCH;
+            while (match_end < match_limit && *match_end == *ref) {
+                match_end++;
+                ref++;
+            }
+
+            uint8_t * token = op++;
+            op = lz4_put_literals(op, token, anchor, ip - anchor);
+
+            size_t offset = match_end - ref;
+            *op++ = offset & 0xFF;
+            *op++ = offset >> 8;
+
+            size_t match_length = match_end - ip - LZ4_MIN_MATCH;
+            *token |= match_length < 15 ? match_length : 15;
+            if (match_length >= 15)
+                op = lz4_put_length(op, match_length - 15);
+
+            ip = anchor = match_end;
+        }
+    }
+
+    uint8_t * token = op++;
+    op = lz4_put_literals(op, token, anchor, end - anchor);
+    return op - dst;
+}
+
+long lz4_decompress(const uint8_t * src, size_t length, uint8_t * dst, size_t capacity) {
+    const uint8_t * ip = src;
+    const uint8_t * iend = src + length;
+    uint8_t * op = dst;
+    uint8_t * oend = dst + capacity;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+        if ((size_t) (iend - ip) < literals || (size_t) (oend - op) < literals) return -1;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        // The last sequence has no match
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t) (op - dst)) return -1;
+
+        size_t match_length = token & 0xF;
+        if (match_length == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                match_length += b;
+            } while (b == 255);
+        }
+        match_length += LZ4_MIN_MATCH;
+        if ((size_t) (oend - op) < match_length) return -1;
+
+        // Matches may overlap their own output
+        const uint8_t * ref = op - offset;
+        while (match_length--)
+            *op++ = *ref++;
+    }
+
+    return op - dst;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compressor and decompressor for the LZ4 block format.
+// This is a simple greedy compressor; it is fast rather than tight.
+
+// Worst-case compressed size of `length` bytes
+#define LZ4_BOUND(length) ((length) + (length) / 255 + 16)
+
+// `dst` must have room for LZ4_BOUND(length) bytes. Returns the compressed size.
+size_t lz4_compress(const uint8_t * src, size_t length, uint8_t * dst);
+
+// Returns the decompressed size, or -1 if `src` is corrupt or doesn't fit in `capacity` bytes
+long lz4_decompress(const uint8_t * src, size_t length, uint8_t * dst, size_t capacity);
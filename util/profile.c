@@ -0,0 +1,433 @@
+#include "util/profile.h"
+
+#include "util/config.h"
+#include "util/err.h"
+#include "util/math.h"
+#include "pattern/soft.h"
+
+#include <SDL2/SDL.h>
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILE_RING_SIZE 1024  // Spans a thread can record between frames; power of two
+#define PROFILE_MAX_THREADS 64
+#define PROFILE_GPU_SPANS 256   // GPU spans in flight, two timer queries each; power of two
+#define PROFILE_GPU_TID 0       // Trace "thread" for GPU spans
+
+bool profile_enabled = false;
+
+struct profile_span {
+    char name[PROFILE_NAME_SIZE];
+    uint64_t start; // ns since profile_init
+    uint64_t end;
+    int tid;
+    bool gpu;
+};
+
+// Written only by the owning thread, read only by profile_frame; same scheme as util/ring.h
+struct profile_thread {
+    char name[32];
+    int tid;
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+    SDL_atomic_t dropped;
+    SDL_atomic_t exited;    // Free for the next new thread, which takes over the ring
+    struct profile_span spans[PROFILE_RING_SIZE];
+};
+
+static SDL_TLSID thread_tls;
+static SDL_SpinLock threads_lock;
+static struct profile_thread * threads[PROFILE_MAX_THREADS];
+static int n_threads;
+
+static Uint64 start_counter;
+static double ns_per_tick;
+
+// Timer queries in flight, oldest first; render thread only
+static int gpu_state = -1; // -1 until the extension is checked
+static GLuint gpu_queries[2 * PROFILE_GPU_SPANS];
+static struct profile_span gpu_spans[PROFILE_GPU_SPANS];
+static bool gpu_ended[PROFILE_GPU_SPANS];
+static unsigned int gpu_head;
+static unsigned int gpu_tail;
+
+// Rolling window of durations for each stage (span name); render thread only
+struct profile_stage {
+    char name[PROFILE_NAME_SIZE];
+    bool gpu;
+    float * window; // ms
+    int count;
+    int next;
+    unsigned long last_frame;
+};
+static struct profile_stage * stages;
+static int n_stages;
+static int stages_size;
+static int window_size;
+static unsigned long frame;
+
+// The most recent spans, for profile_dump; render thread only
+static struct profile_span * trace;
+static size_t trace_size;
+static size_t trace_count; // Ever recorded
+
+void profile_init() {
+    profile_enabled = config.profile.enabled;
+    if(!profile_enabled) return;
+
+    thread_tls = SDL_TLSCreate();
+    start_counter = SDL_GetPerformanceCounter();
+    ns_per_tick = 1e9 / SDL_GetPerformanceFrequency();
+
+    window_size = MAX(config.profile.window, 1);
+    trace_size = MAX(config.profile.trace_events, 1);
+    trace = calloc(trace_size, sizeof *trace);
+    if(trace == NULL) MEMFAIL();
+    trace_count = 0;
+
+    profile_thread("Render");
+}
+
+static struct profile_thread * profile_self() {
+    struct profile_thread * t = SDL_TLSGet(thread_tls);
+    if(t != NULL) return t;
+
+    SDL_AtomicLock(&threads_lock);
+    for(int i = 0; i < n_threads; i++) {
+        if(SDL_AtomicGet(&threads[i]->exited)) {
+            t = threads[i];
+            SDL_AtomicSet(&t->exited, 0);
+            break;
+        }
+    }
+    if(t == NULL && n_threads < PROFILE_MAX_THREADS) {
+        t = calloc(1, sizeof *t);
+        if(t == NULL) MEMFAIL();
+        t->tid = n_threads + 1;
+        threads[n_threads++] = t;
+    }
+    SDL_AtomicUnlock(&threads_lock);
+    if(t == NULL) return NULL;
+
+    snprintf(t->name, sizeof t->name, "Thread %d", t->tid);
+    SDL_TLSSet(thread_tls, t, NULL);
+    return t;
+}
+
+void profile_thread(const char * name) {
+    if(!profile_enabled) return;
+    struct profile_thread * t = profile_self();
+    if(t != NULL) snprintf(t->name, sizeof t->name, "%s", name);
+}
+
+void profile_thread_exit() {
+    if(!profile_enabled) return;
+    struct profile_thread * t = SDL_TLSGet(thread_tls);
+    if(t == NULL) return;
+    SDL_TLSSet(thread_tls, NULL, NULL);
+    SDL_AtomicSet(&t->exited, 1);
+}
+
+uint64_t profile_now() {
+    if(!profile_enabled) return 0;
+    return (SDL_GetPerformanceCounter() - start_counter) * ns_per_tick;
+}
+
+static void profile_cpu_v(uint64_t start, const char * fmt, va_list args) {
+    if(!profile_enabled) return;
+    struct profile_thread * t = profile_self();
+    if(t == NULL) return;
+    uint64_t end = profile_now();
+
+    unsigned int head = SDL_AtomicGet(&t->head);
+    unsigned int tail = SDL_AtomicGet(&t->tail);
+    if(head - tail >= PROFILE_RING_SIZE) {
+        // The render thread hasn't caught up
+        SDL_AtomicAdd(&t->dropped, 1);
+        return;
+    }
+
+    struct profile_span * span = &t->spans[head & (PROFILE_RING_SIZE - 1)];
+    vsnprintf(span->name, sizeof span->name, fmt, args);
+    span->start = start;
+    span->end = end;
+    span->tid = t->tid;
+    span->gpu = false;
+
+    // Publish the span before the new head
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&t->head, head + 1);
+}
+
+void profile_cpu(uint64_t start, const char * fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    profile_cpu_v(start, fmt, args);
+    va_end(args);
+}
+
+static bool profile_gpu_check() {
+    if(gpu_state < 0) {
+        // The software renderer may not even have a GL context
+        const char * extensions = soft_enabled ? NULL : (const char *) glGetString(GL_EXTENSIONS);
+        gpu_state = extensions != NULL && strstr(extensions, "GL_ARB_timer_query") != NULL;
+        if(gpu_state) {
+            glGenQueries(2 * PROFILE_GPU_SPANS, gpu_queries);
+        } else if(!soft_enabled) {
+            WARN("GL_ARB_timer_query isn't supported; only profiling the CPU");
+        }
+    }
+    return gpu_state > 0;
+}
+
+int profile_gpu_begin() {
+    if(!profile_enabled || !profile_gpu_check()) return -1;
+    // Every query is still waiting on the GPU
+    if(gpu_head - gpu_tail >= PROFILE_GPU_SPANS) return -1;
+
+    int span = gpu_head++ & (PROFILE_GPU_SPANS - 1);
+    gpu_ended[span] = false;
+    glQueryCounter(gpu_queries[2 * span], GL_TIMESTAMP);
+    return span;
+}
+
+static void profile_gpu_end_v(int span, const char * fmt, va_list args) {
+    if(span < 0) return;
+    glQueryCounter(gpu_queries[2 * span + 1], GL_TIMESTAMP);
+
+    vsnprintf(gpu_spans[span].name, sizeof gpu_spans[span].name, fmt, args);
+    gpu_spans[span].tid = PROFILE_GPU_TID;
+    gpu_spans[span].gpu = true;
+    gpu_ended[span] = true;
+}
+
+void profile_gpu_end(int span, const char * fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    profile_gpu_end_v(span, fmt, args);
+    va_end(args);
+}
+
+struct profile_mark profile_begin() {
+    return (struct profile_mark) {
+        .start = profile_now(),
+        .span = profile_gpu_begin(),
+    };
+}
+
+void profile_end(struct profile_mark mark, const char * fmt, ...) {
+    if(!profile_enabled) return;
+    va_list args, args_gpu;
+    va_start(args, fmt);
+    va_copy(args_gpu, args);
+    profile_gpu_end_v(mark.span, fmt, args_gpu);
+    profile_cpu_v(mark.start, fmt, args);
+    va_end(args_gpu);
+    va_end(args);
+}
+
+static struct profile_stage * profile_stage(const char * name, bool gpu) {
+    for(int i = 0; i < n_stages; i++) {
+        if(stages[i].gpu == gpu && strcmp(stages[i].name, name) == 0) return &stages[i];
+    }
+
+    if(n_stages == stages_size) {
+        stages_size = stages_size ? 2 * stages_size : 32;
+        struct profile_stage * s = realloc(stages, stages_size * sizeof *stages);
+        if(s == NULL) MEMFAIL();
+        stages = s;
+    }
+    struct profile_stage * stage = &stages[n_stages++];
+    memset(stage, 0, sizeof *stage);
+    snprintf(stage->name, sizeof stage->name, "%s", name);
+    stage->gpu = gpu;
+    stage->window = calloc(window_size, sizeof *stage->window);
+    if(stage->window == NULL) MEMFAIL();
+    return stage;
+}
+
+static void profile_record(const struct profile_span * span) {
+    struct profile_stage * stage = profile_stage(span->name, span->gpu);
+    stage->window[stage->next] = span->end > span->start ? (span->end - span->start) / 1e6 : 0.;
+    stage->next = (stage->next + 1) % window_size;
+    if(stage->count < window_size) stage->count++;
+    stage->last_frame = frame;
+
+    trace[trace_count++ % trace_size] = *span;
+}
+
+static void profile_drain() {
+    SDL_AtomicLock(&threads_lock);
+    int n = n_threads;
+    SDL_AtomicUnlock(&threads_lock);
+
+    for(int i = 0; i < n; i++) {
+        struct profile_thread * t = threads[i];
+        unsigned int tail = SDL_AtomicGet(&t->tail);
+        unsigned int head = SDL_AtomicGet(&t->head);
+        SDL_MemoryBarrierAcquire();
+        for(; tail != head; tail++) {
+            profile_record(&t->spans[tail & (PROFILE_RING_SIZE - 1)]);
+        }
+        SDL_AtomicSet(&t->tail, tail);
+    }
+}
+
+// Collect finished timer queries, in order; this never waits on the GPU
+static void profile_gpu_collect() {
+    if(gpu_state <= 0) return;
+
+    // Both clocks count nanoseconds, so one offset maps GPU timestamps onto profile_now
+    GLint64 gpu_now;
+    glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+    int64_t offset = (int64_t) profile_now() - gpu_now;
+
+    while(gpu_tail != gpu_head) {
+        int span = gpu_tail & (PROFILE_GPU_SPANS - 1);
+        if(!gpu_ended[span]) break;
+        GLint available = 0;
+        glGetQueryObjectiv(gpu_queries[2 * span + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available) break;
+
+        GLuint64 start, end;
+        glGetQueryObjectui64v(gpu_queries[2 * span], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(gpu_queries[2 * span + 1], GL_QUERY_RESULT, &end);
+        gpu_spans[span].start = MAX((int64_t) start + offset, 0);
+        gpu_spans[span].end = MAX((int64_t) end + offset, 0);
+        profile_record(&gpu_spans[span]);
+        gpu_tail++;
+    }
+}
+
+void profile_frame() {
+    if(!profile_enabled) return;
+    frame++;
+    profile_drain();
+    profile_gpu_collect();
+}
+
+static int profile_compare_float(const void * a, const void * b) {
+    float x = *(const float *) a;
+    float y = *(const float *) b;
+    return (x > y) - (x < y);
+}
+
+static int profile_compare_stat(const void * a, const void * b) {
+    const struct profile_stat * x = a;
+    const struct profile_stat * y = b;
+    if(x->gpu != y->gpu) return x->gpu - y->gpu;
+    return strcmp(x->name, y->name);
+}
+
+int profile_stats(struct profile_stat * stats, int n) {
+    if(!profile_enabled) return 0;
+
+    float * sorted = malloc(window_size * sizeof *sorted);
+    if(sorted == NULL) MEMFAIL();
+    unsigned long recent = MAX(config.ui.fps, 1);
+    int k = 0;
+    for(int i = 0; i < n_stages && k < n; i++) {
+        const struct profile_stage * stage = &stages[i];
+        if(stage->count == 0 || frame - stage->last_frame > recent) continue;
+
+        memcpy(sorted, stage->window, stage->count * sizeof *sorted);
+        qsort(sorted, stage->count, sizeof *sorted, &profile_compare_float);
+        struct profile_stat * stat = &stats[k++];
+        snprintf(stat->name, sizeof stat->name, "%s", stage->name);
+        stat->gpu = stage->gpu;
+        stat->p50 = sorted[(stage->count - 1) * 50 / 100];
+        stat->p99 = sorted[(stage->count - 1) * 99 / 100];
+        stat->count = stage->count;
+    }
+    free(sorted);
+
+    qsort(stats, k, sizeof *stats, &profile_compare_stat);
+    return k;
+}
+
+static void profile_json_string(FILE * f, const char * s) {
+    fputc('"', f);
+    for(; *s != '\0'; s++) {
+        if((unsigned char) *s < 0x20) continue;
+        if(*s == '"' || *s == '\\') fputc('\\', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+int profile_dump(const char * path) {
+    if(!profile_enabled) return -1;
+
+    FILE * f = fopen(path, "w");
+    if(f == NULL) {
+        PERROR("Unable to open '%s'", path);
+        return -1;
+    }
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"GPU\"}}",
+            PROFILE_GPU_TID);
+    SDL_AtomicLock(&threads_lock);
+    int n = n_threads;
+    SDL_AtomicUnlock(&threads_lock);
+    for(int i = 0; i < n; i++) {
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", threads[i]->tid);
+        profile_json_string(f, threads[i]->name);
+        fprintf(f, "}}");
+    }
+
+    size_t n_spans = MIN(trace_count, trace_size);
+    for(size_t i = trace_count - n_spans; i < trace_count; i++) {
+        const struct profile_span * span = &trace[i % trace_size];
+        fprintf(f, ",\n{\"name\":");
+        profile_json_string(f, span->name);
+        fprintf(f, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                span->gpu ? "gpu" : "cpu", span->tid, span->start / 1e3,
+                span->end > span->start ? (span->end - span->start) / 1e3 : 0.);
+    }
+    fprintf(f, "\n]}\n");
+
+    int rc = ferror(f) ? -1 : 0;
+    if(fclose(f) != 0) rc = -1;
+    if(rc < 0) {
+        PERROR("Unable to write '%s'", path);
+    } else {
+        INFO("Wrote %zu profile spans to '%s'", n_spans, path);
+    }
+    return rc;
+}
+
+void profile_term() {
+    if(!profile_enabled) return;
+
+    profile_drain();
+    if(config.profile.trace[0] != '\0') profile_dump(config.profile.trace);
+
+    unsigned long dropped = 0;
+    for(int i = 0; i < n_threads; i++) {
+        dropped += SDL_AtomicGet(&threads[i]->dropped);
+        free(threads[i]);
+        threads[i] = NULL;
+    }
+    n_threads = 0;
+    if(dropped > 0) WARN("Dropped %lu profile spans; profile_frame wasn't called often enough", dropped);
+
+    for(int i = 0; i < n_stages; i++) {
+        free(stages[i].window);
+    }
+    free(stages);
+    stages = NULL;
+    n_stages = stages_size = 0;
+    free(trace);
+    trace = NULL;
+    trace_size = trace_count = 0;
+
+    // The timer queries went with the GL context
+    gpu_state = -1;
+    gpu_head = gpu_tail = 0;
+    profile_enabled = false;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Frame-time profiler, enabled with `[profile] enabled`.
+//
+// Any thread can time a span of CPU work with profile_now & profile_cpu, and the render
+// thread can time GL commands with profile_gpu_begin & profile_gpu_end. Each thread records
+// its spans into its own lock-free ring. Once per frame, profile_frame (on the render thread)
+// drains the rings and collects finished GPU timer queries. The spans feed rolling per-stage
+// percentiles and a trace of the most recent spans, which can be written out for
+// chrome://tracing.
+//
+// Spans may nest. With profiling disabled, every call returns right away.
+
+#define PROFILE_NAME_SIZE 48
+
+struct profile_stat {
+    char name[PROFILE_NAME_SIZE];
+    bool gpu;
+    double p50; // ms
+    double p99; // ms
+    int count;  // Spans in the window
+};
+
+extern bool profile_enabled;
+
+// Call before starting any threads
+void profile_init();
+// Call after stopping them, and after the GL context is gone; writes `[profile] trace`, if set
+void profile_term();
+
+// Name the calling thread in the trace
+void profile_thread(const char * name);
+// Call before a short-lived thread returns, so the next thread can reuse its ring
+void profile_thread_exit();
+
+// Nanoseconds since profile_init; 0 if profiling is disabled
+uint64_t profile_now();
+// Record a span from `start` (from profile_now) until now
+void profile_cpu(uint64_t start, const char * fmt, ...);
+
+// Render thread only. profile_gpu_begin returns -1 if the span won't be timed
+// (e.g. no GL_ARB_timer_query), which profile_gpu_end ignores.
+int profile_gpu_begin();
+void profile_gpu_end(int span, const char * fmt, ...);
+
+// Both at once, for stages of the render thread: the CPU span covers issuing the GL
+// commands (or, with the software renderer, all of the work)
+struct profile_mark {
+    uint64_t start;
+    int span;
+};
+struct profile_mark profile_begin();
+void profile_end(struct profile_mark mark, const char * fmt, ...);
+
+// Render thread only, once per frame
+void profile_frame();
+// Stages seen in the last second, sorted by name with CPU stages first. Returns the number written.
+int profile_stats(struct profile_stat * stats, int n);
+// Write the trace as Chrome trace event JSON. Returns 0 on success.
+int profile_dump(const char * path);
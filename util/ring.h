@@ -0,0 +1,58 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "util/err.h"
+
+// Lock-free single-producer/single-consumer queue of pointers.
+// Exactly one thread may push and exactly one thread may pop.
+
+struct ring {
+    void ** items;
+    unsigned int size;      // Power of two
+    SDL_atomic_t head;      // Written only by the producer
+    SDL_atomic_t tail;      // Written only by the consumer
+};
+
+static inline void ring_init(struct ring * ring, unsigned int size) {
+    ring->size = 1;
+    while (ring->size < size)
+        ring->size <<= 1;
+    ring->items = calloc(ring->size, sizeof *ring->items);
+    if (ring->items == NULL) MEMFAIL();
+    SDL_AtomicSet(&ring->head, 0);
+    SDL_AtomicSet(&ring->tail, 0);
+}
+
+static inline void ring_term(struct ring * ring) {
+    free(ring->items);
+    ring->items = NULL;
+    ring->size = 0;
+}
+
+// Returns false if the ring is full
+static inline bool ring_push(struct ring * ring, void * item) {
+    unsigned int head = SDL_AtomicGet(&ring->head);
+    unsigned int tail = SDL_AtomicGet(&ring->tail);
+    if (head - tail >= ring->size) return false;
+
+    ring->items[head & (ring->size - 1)] = item;
+    // Publish the item before the new head
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&ring->head, head + 1);
+    return true;
+}
+
+// Returns NULL if the ring is empty
+static inline void * ring_pop(struct ring * ring) {
+    unsigned int tail = SDL_AtomicGet(&ring->tail);
+    unsigned int head = SDL_AtomicGet(&ring->head);
+    if (head == tail) return NULL;
+
+    SDL_MemoryBarrierAcquire();
+    void * item = ring->items[tail & (ring->size - 1)];
+    SDL_AtomicSet(&ring->tail, tail + 1);
+    return item;
+}
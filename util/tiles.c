@@ -0,0 +1,134 @@
+#include "util/tiles.h"
+#include "util/err.h"
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_thread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+struct tiles_worker {
+    SDL_Thread * thread;
+    SDL_sem * start;
+    // Remaining tiles [begin, end)
+    SDL_SpinLock lock;
+    int begin;
+    int end;
+};
+
+static struct tiles_worker * workers = NULL;
+static int n_workers = 0; // Including the calling thread, which is workers[0]
+
+static void (*job_fn)(void * arg, int tile);
+static void * job_arg;
+static SDL_atomic_t job_busy;
+static SDL_sem * job_done = NULL;
+static volatile bool tiles_quit = false;
+
+static bool worker_pop(struct tiles_worker * w, int * tile) {
+    bool ok = false;
+    SDL_AtomicLock(&w->lock);
+    if(w->begin < w->end) {
+        *tile = w->begin++;
+        ok = true;
+    }
+    SDL_AtomicUnlock(&w->lock);
+    return ok;
+}
+
+static bool worker_steal(struct tiles_worker * w) {
+    for(int i = 1; i < n_workers; i++) {
+        struct tiles_worker * victim = &workers[(w - workers + i) % n_workers];
+        int begin = 0, end = 0;
+        SDL_AtomicLock(&victim->lock);
+        int n = victim->end - victim->begin;
+        if(n > 0) {
+            end = victim->end;
+            begin = end - (n + 1) / 2;
+            victim->end = begin;
+        }
+        SDL_AtomicUnlock(&victim->lock);
+
+        if(end > begin) {
+            SDL_AtomicLock(&w->lock);
+            w->begin = begin;
+            w->end = end;
+            SDL_AtomicUnlock(&w->lock);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void worker_work(struct tiles_worker * w) {
+    int tile;
+    do {
+        while(worker_pop(w, &tile)) job_fn(job_arg, tile);
+    } while(worker_steal(w));
+}
+
+static int tiles_worker_run(void * args) {
+    struct tiles_worker * w = args;
+    for(;;) {
+        SDL_SemWait(w->start);
+        if(tiles_quit) break;
+        worker_work(w);
+        if(SDL_AtomicDecRef(&job_busy)) SDL_SemPost(job_done);
+    }
+    return 0;
+}
+
+void tiles_start(int n_threads) {
+    if(n_threads <= 0) n_threads = SDL_GetCPUCount();
+    if(n_threads < 1) n_threads = 1;
+
+    n_workers = n_threads;
+    workers = calloc(n_workers, sizeof *workers);
+    if(workers == NULL) MEMFAIL();
+    job_done = SDL_CreateSemaphore(0);
+    if(job_done == NULL) FAIL("Could not create semaphore: %s", SDL_GetError());
+    tiles_quit = false;
+
+    for(int i = 1; i < n_workers; i++) {
+        struct tiles_worker * w = &workers[i];
+        w->start = SDL_CreateSemaphore(0);
+        if(w->start == NULL) FAIL("Could not create semaphore: %s", SDL_GetError());
+        w->thread = SDL_CreateThread(&tiles_worker_run, "Tiles", w);
+        if(w->thread == NULL) FAIL("Could not create tile worker thread: %s", SDL_GetError());
+    }
+    INFO("Rendering tiles on %d threads", n_workers);
+}
+
+void tiles_stop() {
+    tiles_quit = true;
+    for(int i = 1; i < n_workers; i++) {
+        SDL_SemPost(workers[i].start);
+        SDL_WaitThread(workers[i].thread, NULL);
+        SDL_DestroySemaphore(workers[i].start);
+    }
+    if(job_done != NULL) SDL_DestroySemaphore(job_done);
+    job_done = NULL;
+    free(workers);
+    workers = NULL;
+    n_workers = 0;
+}
+
+void tiles_run(int n_tiles, void (*fn)(void * arg, int tile), void * arg) {
+    if(n_workers <= 1 || n_tiles <= 1) {
+        for(int i = 0; i < n_tiles; i++) fn(arg, i);
+        return;
+    }
+
+    job_fn = fn;
+    job_arg = arg;
+    for(int i = 0; i < n_workers; i++) {
+        workers[i].begin = n_tiles * i / n_workers;
+        workers[i].end = n_tiles * (i + 1) / n_workers;
+    }
+    SDL_AtomicSet(&job_busy, n_workers - 1);
+    for(int i = 1; i < n_workers; i++) {
+        SDL_SemPost(workers[i].start);
+    }
+
+    worker_work(&workers[0]);
+    SDL_SemWait(job_done);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// Runs `fn` over tiles 0..n_tiles-1 on a pool of worker threads.
+//
+// Each worker starts with a contiguous share of the tiles and takes them from the
+// front; a worker that runs out steals the back half of another worker's share.
+// The calling thread works too, and tiles_run returns once every tile is done.
+
+void tiles_start(int n_threads); // 0 for one thread per core
+void tiles_stop();
+
+// Not re-entrant: call from one thread at a time
+void tiles_run(int n_tiles, void (*fn)(void * arg, int tile), void * arg);